@@ -14,6 +14,10 @@
 // Input handling
 //******************************************************************************
 
+#define VCF_CHUNK_QUEUE 4       // max number of chunks waiting to be split
+#define VCF_BATCH_QUEUE 2       // max number of batches waiting to be parsed, per parsing thread
+#define VCF_BATCH_SIZE  1048576 // min number of bytes per batch (1 Mb), unless line is longer
+
 const std::vector<std::string> vcf_required_columns = {
 	"#CHROM",
 	"POS",
@@ -111,6 +115,8 @@ FilterInput::FilterMarkerStat::FilterMarkerStat()
 , remove_hap_above_(false)
 , remove_gen_below_(false)
 , remove_gen_above_(false)
+, prefilter_info_(false)
+, validate_info_(false)
 {}
 
 void FilterInput::FilterMarkerStat::remove_hap_below(const std::string & str, const size_t size)
@@ -153,6 +159,17 @@ void FilterInput::FilterMarkerStat::remove_gen_above(const std::string & str, co
 	this->remove_gen_above_ = true;
 }
 
+void FilterInput::FilterMarkerStat::prefilter_info(const bool validate)
+{
+	if (validate)
+		std::clog << "Filter applied: validate allele counts in INFO column" << std::endl;
+	else
+		std::clog << "Filter applied: prefilter allele counts in INFO column" << std::endl;
+	
+	this->prefilter_info_ = true;
+	this->validate_info_ = validate;
+}
+
 
 FilterInput::FilterMarkerGmap::FilterMarkerGmap()
 : any(false)
@@ -275,14 +292,14 @@ bool FilterInput::apply(const MarkerStat & stat, std::string & comment) const
 		return true;
 	
 	int i;
-	const int h_size = stat.haplotype.size();
-	const int g_size = stat.genotype.size();
+	const int h_size = stat.haplotype_size();
+	const int g_size = stat.genotype_size();
 	
 	if (this->markerstat.remove_hap_below_)
 	{
 		for (i = 0; i < h_size; ++i)
 		{
-			if (stat.haplotype.census(i) <= this->markerstat.remove_hap_below_cutoff)
+			if (stat.haplotype(i) <= this->markerstat.remove_hap_below_cutoff)
 			{
 				comment = "Marker excluded: allele count/frequency below threshold";
 				return false;
@@ -294,7 +311,7 @@ bool FilterInput::apply(const MarkerStat & stat, std::string & comment) const
 	{
 		for (i = 0; i < h_size; ++i)
 		{
-			if (stat.haplotype.census(i) >= this->markerstat.remove_hap_above_cutoff)
+			if (stat.haplotype(i) >= this->markerstat.remove_hap_above_cutoff)
 			{
 				comment = "Marker excluded: allele count/frequency above threshold";
 				return false;
@@ -306,7 +323,7 @@ bool FilterInput::apply(const MarkerStat & stat, std::string & comment) const
 	{
 		for (i = 0; i < g_size; ++i)
 		{
-			if (stat.genotype.census(i) <= this->markerstat.remove_gen_below_cutoff)
+			if (stat.genotype(i) <= this->markerstat.remove_gen_below_cutoff)
 			{
 				comment = "Marker excluded: genotype count/frequency below threshold";
 				return false;
@@ -318,7 +335,7 @@ bool FilterInput::apply(const MarkerStat & stat, std::string & comment) const
 	{
 		for (i = 0; i < g_size; ++i)
 		{
-			if (stat.genotype.census(i) >= this->markerstat.remove_gen_above_cutoff)
+			if (stat.genotype(i) >= this->markerstat.remove_gen_above_cutoff)
 			{
 				comment = "Marker excluded: genotype count/frequency above threshold";
 				return false;
@@ -329,6 +346,40 @@ bool FilterInput::apply(const MarkerStat & stat, std::string & comment) const
 	return true;
 }
 
+bool FilterInput::apply(const std::vector<size_t> & count, const size_t size, std::string & comment) const
+{
+	if (! this->markerstat.any)
+		return true;
+	
+	const size_t h_size = count.size();
+	
+	if (this->markerstat.remove_hap_below_)
+	{
+		for (size_t i = 0; i < h_size; ++i)
+		{
+			if (Census(count[i], size * 2) <= this->markerstat.remove_hap_below_cutoff) // scale: two haplotypes per genotype
+			{
+				comment = "Marker excluded: allele count/frequency below threshold";
+				return false;
+			}
+		}
+	}
+	
+	if (this->markerstat.remove_hap_above_)
+	{
+		for (size_t i = 0; i < h_size; ++i)
+		{
+			if (Census(count[i], size * 2) >= this->markerstat.remove_hap_above_cutoff) // scale: two haplotypes per genotype
+			{
+				comment = "Marker excluded: allele count/frequency above threshold";
+				return false;
+			}
+		}
+	}
+	
+	return true;
+}
+
 bool FilterInput::apply(const MarkerGmap & gmap, std::string & comment) const
 {
 	if (! this->markergmap.any)
@@ -383,7 +434,12 @@ Input_VCF::Input_VCF(const std::string & filename)
 , size(0)
 , sample_(false)
 , genmap_(false)
-, good(true)
+, carrier_(false)
+, region_(false)
+, _region_begin(0)
+, _region_end(0)
+, queue_chunk(VCF_CHUNK_QUEUE)
+, n_line(0)
 {
 	size_t n_head = 0;
 	bool flag = false;
@@ -617,11 +673,99 @@ void Input_VCF::genmap(const std::string & filename)
 	this->genmap_ = true;
 }
 
+void Input_VCF::carrier(const Cutoff & cutoff)
+{
+	this->_carrier = cutoff; // scaled when sample size is known
+	this->carrier_ = true;
+}
+
+void Input_VCF::region(const std::string & str)
+{
+	std::string seq = str;
+	size_t beg = 1, end = SIZE_MAX;
+	
+	// parse chr:start-end, chr:start or chr
+	const size_t colon = str.rfind(':');
+	
+	if (colon != std::string::npos)
+	{
+		std::string range = str.substr(colon + 1);
+		range.erase(std::remove(range.begin(), range.end(), ','), range.end());
+		
+		seq = str.substr(0, colon);
+		
+		const size_t dash = range.find('-');
+		
+		try
+		{
+			beg = std::stoul(range.substr(0, dash));
+			
+			if (dash != std::string::npos && dash + 1 < range.size())
+				end = std::stoul(range.substr(dash + 1));
+			else if (dash == std::string::npos)
+				end = beg;
+		}
+		catch (const std::exception &)
+		{
+			throw std::invalid_argument("Cannot interpret region: " + str);
+		}
+	}
+	
+	if (seq.empty() || beg < 1 || end < beg)
+	{
+		throw std::invalid_argument("Cannot interpret region: " + str);
+	}
+	
+	// chromosome as parsed from input lines, numeric only
+	const std::string num = (seq.compare(0, 3, "chr") == 0) ? seq.substr(3): seq;
+	
+	if (num.empty() || num.size() > 3 || num.find_first_not_of("0123456789") != std::string::npos)
+	{
+		throw std::invalid_argument("Region chromosome must be numeric: " + seq);
+	}
+	
+	this->_region_chr = std::stoi(num);
+	
+	if (this->_region_chr.is_unknown())
+	{
+		throw std::invalid_argument("Region chromosome out of range: " + seq);
+	}
+	
+	// locate index next to input file
+	std::string index;
+	
+	for (const char * ext : { ".tbi", ".csi" })
+	{
+		if (std::ifstream(this->line.source() + ext).good())
+		{
+			index = this->line.source() + ext;
+			break;
+		}
+	}
+	
+	if (index.empty())
+	{
+		throw std::invalid_argument("Cannot find index (.tbi or .csi) of input file: " + this->line.source());
+	}
+	
+	// seek to blocks covering region
+	StreamIndex tabix(index);
+	
+	this->line.seek(tabix.query(seq, beg - 1, end));
+	
+	this->_region_begin = beg;
+	this->_region_end = end;
+	
+	std::clog << "Region applied: " << str << " (index: " << index << ")" << std::endl;
+	this->region_ = true;
+}
+
 void Input_VCF::source_sample(Source & source)
 {
 	std::string comment;
 	
 	this->skipsample.size = 0;
+	this->skipsample.mask.assign(this->size, 0);
 	
 	for (size_t i = 0; i < this->size; ++i)
 	{
@@ -631,101 +775,214 @@ void Input_VCF::source_sample(Source & source)
 			Sample sample;
 			sample.info = std::move(this->_sample[i]);
 			source.append(std::move(sample));
+			this->skipsample.mask[i] = 1;
 			continue;
 		}
 		
 		std::clog << comment << std::endl;
 		
-		this->skipsample.index.push_back(i);
 		++this->skipsample.size;
 	}
 	
 	this->skipsample.flag = (this->skipsample.size != 0);
 	
+	if (this->skipsample.flag && this->filter.markerstat.prefilter_info_)
+	{
+		std::clog << "INFO allele counts not applicable after excluding samples, prefilter disabled" << std::endl;
+	}
+	
+	// count runs of kept columns, so that parsing stops before each skipped column
+	for (size_t i = this->size; i > 1; --i)
+	{
+		if (this->skipsample.mask[i - 2] != 0 && this->skipsample.mask[i - 1] != 0)
+		{
+			this->skipsample.mask[i - 2] += this->skipsample.mask[i - 1];
+		}
+	}
+	
 	this->_sample.clear();
 }
 
-void Input_VCF::source_marker(Source & source, ProgressMsg & progress)
+void Input_VCF::read_chunk()
 {
-	thread_local std::string comment;
-	thread_local std::vector<char> current;
-	thread_local size_t line_num;
-	
-	while(this->good)
+	try
 	{
-		this->ex_line.lock();
-		
-		// load next line
-		if (this->line.next())
+		while (true)
 		{
-			size_t n = strlen(this->line);
-			current.resize(n + 1);
-			strcpy(&current[0], this->line);
-			current[n] = '\0';
-			line_num = this->line.count();
+			std::shared_ptr<StreamChunk> chunk(new StreamChunk());
 			
-			progress.update();
+			if (! this->line.chunk(*chunk))
+				break;
+			
+			if (! this->queue_chunk.push(std::move(chunk))) // cancelled after parsing failed
+				break;
 		}
-		else
+	}
+	catch (...)
+	{
+		this->ex_read = std::current_exception(); // rethrown after pipeline finished
+	}
+	
+	this->queue_chunk.close();
+}
+
+void Input_VCF::split_chunk()
+{
+	std::shared_ptr<StreamChunk> chunk;
+	
+	this->n_line = this->line.count();
+	
+	while (this->queue_chunk.pop(chunk))
+	{
+		chunk->split();
+		chunk->first = this->n_line + 1;
+		
+		const size_t n = chunk->line.size();
+		size_t begin = 0, bytes = 0;
+		
+		// hand out batches of lines
+		for (size_t i = 0; i < n; ++i)
 		{
-			this->good = false;
-			this->ex_line.unlock();
-			break;
+			bytes += ((i + 1 < n) ? chunk->line[i + 1]: chunk->end) - chunk->line[i];
+			
+			if (bytes >= VCF_BATCH_SIZE || i + 1 == n)
+			{
+				Batch batch = { chunk, begin, i + 1 };
+				
+				if (! this->queue_batch->push(std::move(batch))) // cancelled after parsing failed
+					return;
+				
+				begin = i + 1;
+				bytes = 0;
+			}
 		}
 		
-		this->ex_line.unlock();
+		this->n_line += n;
 		
-		Marker marker(this->size);
+		chunk.reset();
+	}
+	
+	this->queue_batch->close();
+}
+
+void Input_VCF::source_marker(Source & source, ProgressCounter & progress)
+{
+	thread_local std::string comment;
+	thread_local size_t line_num;
+	thread_local std::vector<size_t> count; // allele counts from INFO column
+	thread_local size_t tally[ MARKER_STAT_VALUES ]; // genotype counts by raw value, collected while parsing
+	
+	// counts in INFO column refer to all samples in file
+	const bool info = (this->filter.markerstat.prefilter_info_ && ! this->skipsample.flag);
+	const bool validate = (info && this->filter.markerstat.validate_info_);
+	
+	try
+	{
+		Batch batch;
 		
-		// parse marker
-		if (parse_vcf_line(&current[0], marker.info, marker.data, comment))
+		while (this->queue_batch->pop(batch))
 		{
-			// remove skipped samples
-			if (this->skipsample.flag)
+			progress.update(batch.end - batch.begin);
+			
+			for (size_t k = batch.begin; k < batch.end; ++k)
 			{
-				for (thread_local size_t i = 0; i < this->skipsample.size; ++i)
+				char * current = batch.chunk->line[k];
+				line_num = batch.chunk->first + k;
+				
+				// prefilter allele counts from INFO column, before any genotype is parsed
+				const bool has_count = (info && parse_vcf_info_count(current, count, this->size));
+				
+				if (has_count && ! validate && ! this->filter.apply(count, this->size, comment))
 				{
-					if (! marker.data.erase(this->skipsample.index[i] - i)) // account for reduced size after previous skips
-					{
-						throw std::logic_error("Unexpected error while removing samples");
-					}
+					this->log(comment, line_num);
+					continue;
 				}
-			}
-
-			// approximate from genetic map
-			if (this->genmap_)
-			{
-				marker.gmap = this->_genmap.approx(marker.info);
-			}
-			
-			// evaluate marker stats
-			if (marker.stat.evaluate(marker.info, marker.data))
-			{
-				// filter marker
-				if (this->filter.apply(marker.info, comment) &&
-					this->filter.apply(marker.data, comment) &&
-					this->filter.apply(marker.stat, comment) &&
-					this->filter.apply(marker.gmap, comment) )
+				
+				Marker marker(this->size - this->skipsample.size);
+				
+				std::fill(tally, tally + MARKER_STAT_VALUES, 0);
+				
+				// parse marker, excluded sample columns are not decoded
+				if (parse_vcf_line(current, marker.info, marker.data, comment, (this->skipsample.flag) ? &this->skipsample.mask: NULL, tally))
 				{
-					this->ex_source.lock();
-					source.append(std::move(marker));
-					this->ex_source.unlock();
+					// skip markers outside region
+					if (this->region_ &&
+						(! marker.info.chr.match(this->_region_chr) ||
+						 marker.info.pos < this->_region_begin ||
+						 marker.info.pos > this->_region_end))
+					{
+						continue;
+					}
+					
+					// approximate from genetic map
+					if (this->genmap_)
+					{
+						marker.gmap = this->_genmap.approx(marker.info);
+					}
+					
+					// evaluate marker stats
+					if (marker.stat.evaluate(marker.info, tally, marker.data.size()))
+					{
+						// cross-check allele counts from INFO column
+						if (validate && has_count)
+						{
+							for (size_t h = 0; h < count.size(); ++h)
+							{
+								if (static_cast<int>(h) >= marker.info.allele.size() ||
+									static_cast<size_t>(marker.stat[Haplotype(static_cast<int>(h))]) != count[h])
+								{
+									this->log("Allele counts in INFO column differ from genotypes at position " + std::to_string(marker.info.pos), line_num);
+									break;
+								}
+							}
+						}
+						
+						// filter marker
+						if (this->filter.apply(marker.info, comment) &&
+							this->filter.apply(marker.data, comment) &&
+							this->filter.apply(marker.stat, comment) &&
+							this->filter.apply(marker.gmap, comment) )
+						{
+							// index carriers of rare haplotypes
+							if (this->carrier_)
+							{
+								marker.carrier.evaluate(marker.stat, marker.data, this->_carrier);
+							}
+							
+							// compress marker data outside of lock
+							source.pack(marker);
+							
+							std::lock_guard<std::mutex> lock(this->ex_source);
+							source.append(std::move(marker), line_num);
+						}
+						else
+						{
+							this->log(comment, line_num);
+						}
+					}
+					else
+					{
+						this->log("Invalid allele definition: " + marker.info.str(), line_num);
+					}
 				}
 				else
 				{
 					this->log(comment, line_num);
 				}
 			}
-			else
-			{
-				this->log("Invalid allele definition: " + marker.info.str(), line_num);
-			}
-		}
-		else
-		{
-			this->log(comment, line_num);
 		}
 	}
+	catch (...)
+	{
+		std::lock_guard<std::mutex> lock(this->ex_error);
+		
+		if (! this->ex_parse)
+			this->ex_parse = std::current_exception(); // rethrown after pipeline finished
+		
+		// stop reading & splitting, discard queued lines
+		this->queue_chunk.cancel();
+		this->queue_batch->cancel();
+	}
 }
 
 void Input_VCF::run(Source & source, const int threads)
@@ -733,11 +990,28 @@ void Input_VCF::run(Source & source, const int threads)
 	// source samples
 	this->source_sample(source);
 	
+	// scale carrier threshold with sample size
+	if (this->carrier_)
+	{
+		this->_carrier.scale(source.sample_size() * 2); // two haplotypes per individual
+	}
+	
 	std::cout << "Loading input data" << std::endl;
 	std::clog << "Loading input data: " << this->line.source() << std::endl;
 	ProgressMsg progress("lines");
+	ProgressCounter counter(progress);
 	Runtime timer;
 	
+	// inflate compressed blocks on all threads
+	this->line.threads(threads);
+	
+	// bound lines in flight, queued batches keep their chunks alive
+	this->queue_batch.reset(new StreamQueue<Batch>(VCF_BATCH_QUEUE * std::max(threads, 1)));
+	
+	// read & split on separate threads
+	std::thread reader(&Input_VCF::read_chunk, this);
+	std::thread splitter(&Input_VCF::split_chunk, this);
+	
 	// source markers
 	if (threads > 1)
 	{
@@ -745,10 +1019,10 @@ void Input_VCF::run(Source & source, const int threads)
 		
 		for (int i = 0; i < threads - 1; ++i)
 		{
-			t.push_back(std::thread(&Input_VCF::source_marker, this, std::ref(source),  std::ref(progress)));
+			t.push_back(std::thread(&Input_VCF::source_marker, this, std::ref(source),  std::ref(counter)));
 		}
 		
-		this->source_marker(source, progress); // on this thread
+		this->source_marker(source, counter); // on this thread
 		
 		for (int i = 0; i < threads - 1; ++i)
 		{
@@ -757,10 +1031,24 @@ void Input_VCF::run(Source & source, const int threads)
 	}
 	else
 	{
-		this->source_marker(source, progress);
+		this->source_marker(source, counter);
+	}
+	
+	reader.join();
+	splitter.join();
+	
+	if (this->ex_read)
+	{
+		std::rethrow_exception(this->ex_read);
+	}
+	
+	if (this->ex_parse)
+	{
+		std::rethrow_exception(this->ex_parse);
 	}
 	
-	progress.finish(this->line.count());
+	counter.finish();
+	progress.finish(this->n_line);
 	std::clog << "Done! " << timer.str() << std::endl << std::endl;
 }
 
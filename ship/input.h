@@ -20,9 +20,11 @@
 #include <deque>
 #include <algorithm>
 #include <stdexcept>
+#include <exception>
 #include <thread>
 #include <mutex>
 #include <functional>
+#include <memory>
 
 #include "timer.h"
 #include "stream.h"
@@ -103,6 +105,9 @@ private:
 		Cutoff remove_gen_below_cutoff; // equal or lower
 		Cutoff remove_gen_above_cutoff; // equal or greater
 		
+		bool prefilter_info_; // flag that allele counts are read from INFO column before parsing genotypes
+		bool validate_info_; // flag that INFO allele counts are only cross-checked with genotypes
+		
 	public:
 		
 		// set filters
@@ -111,8 +116,12 @@ private:
 		void remove_gen_below(const std::string &, const size_t);
 		void remove_gen_above(const std::string &, const size_t);
 		
+		// prefilter allele counts from INFO column (AC/AN or AF), optionally validate only
+		void prefilter_info(const bool = false);
+		
 		FilterMarkerStat();
 		friend class FilterInput;
+		friend class Input_VCF;
 	};
 	
 	class FilterMarkerGmap
@@ -167,6 +176,9 @@ public:
 	bool apply(const MarkerStat &, std::string &) const;
 	bool apply(const MarkerGmap &, std::string &) const;
 	bool apply(const SampleInfo &, std::string &) const;
+	
+	// apply allele count filters on counts from INFO column, given sample size
+	bool apply(const std::vector<size_t> &, const size_t, std::string &) const;
 };
 
 
@@ -179,24 +191,41 @@ private:
 	
 	struct SkipSample
 	{
-		std::vector<size_t> index; // skip sample index
+		std::vector<size_t> mask; // per sample column, number of consecutive kept columns starting there (0 if skipped)
 		size_t size; // count skipped samples
 		bool flag; // flag that samples were skipped
 	};
+	
+	// batch of lines handed to parsing threads
+	struct Batch
+	{
+		std::shared_ptr<StreamChunk> chunk; // chunk holding lines
+		size_t begin, end; // range of lines in chunk
+	};
 
 	StreamLine line; // input file stream
 	size_t size; // detected sample size
 	
 	bool sample_; // flag that sample file was provided (optional)
 	bool genmap_; // flag that genetic map file was provided (optional)
+	bool carrier_; // flag that carriers of rare haplotypes are indexed (optional)
+	bool region_; // flag that input is restricted to region (optional)
 	
 	std::vector<SampleInfo> _sample; // sample information
 	Genmap                  _genmap; // genetic map container
+	Cutoff                  _carrier; // threshold for indexing carriers
+	Chromosome              _region_chr; // region chromosome
+	size_t                  _region_begin, _region_end; // region positions (1-based, inclusive)
 	
 	SkipSample skipsample; // index of samples to skip
 	
-	std::mutex ex_line, ex_log, ex_source; // mutexes for multi-threading
-	bool good;
+	StreamQueue< std::shared_ptr<StreamChunk> > queue_chunk; // chunks read from file
+	std::unique_ptr< StreamQueue<Batch> >       queue_batch; // batches of split lines, sized by threads
+	size_t n_line; // number of lines read
+	std::exception_ptr ex_read; // exception while reading file
+	std::exception_ptr ex_parse; // first exception while parsing lines
+	
+	std::mutex ex_log, ex_source, ex_error; // mutexes for multi-threading
 	
 	void log(const std::string &, const size_t); // log warning message
 	std::string error(const std::string &) const; // error message when throwing
@@ -204,8 +233,14 @@ private:
 	// append samples to source
 	void source_sample(Source &);
 	
-	// append markers to source
-	void source_marker(Source &, ProgressMsg &);
+	// read chunks from file (pipeline stage 1)
+	void read_chunk();
+	
+	// split chunks into batches of lines (pipeline stage 2)
+	void split_chunk();
+	
+	// append markers to source (pipeline stage 3)
+	void source_marker(Source &, ProgressCounter &);
 	void parse_marker(char *, Marker &, bool &, std::string &);
 	
 public:
@@ -214,6 +249,8 @@ public:
 	
 	void sample(const std::string &);
 	void genmap(const std::string &);
+	void carrier(const Cutoff &);
+	void region(const std::string &);
 	
 	void run(Source &, const int);
 	
@@ -11,6 +11,7 @@
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include <sstream>
 #include <exception>
 #include <stdexcept>
 
@@ -68,7 +69,15 @@ int main(int argc, const char * argv[])
 	
 	// options
 	cmd.register_opt("threads", 1, false); // threads
+	cmd.register_opt("region", 1, false); // region, requires indexed input file
+	cmd.register_opt("cache", 1, false); // binary snapshot of loaded input data
+	cmd.register_opt("shared_format", 1, false); // sharing output, "dense" matrix, "sparse" pairs or "binary" matrix
+	cmd.register_opt("shared_gzip", 0, false); // compress sharing output
+	cmd.register_opt("trees", 1, false); // binary file of scanned shared haplotype trees
+	cmd.register_opt("tiled", 0, false); // scan sample-major tiles of genotype data
+	cmd.register_opt("shared_pairs", 1, false); // pairs counted per rare haplotype, "adjacent" or "all" carriers
 	cmd.register_opt("remove_unknown_markers", 0, false);
+	cmd.register_opt("prefilter_info", -1, false); // allele counts read from INFO column before parsing genotypes, "validate" to cross-check only
 	
 	if(! cmd.parse())
 	{
@@ -86,6 +95,53 @@ int main(int argc, const char * argv[])
 		return EXIT_FAILURE;
 	}
 	
+	//
+	// determine format of sharing output
+	//
+	std::string shared_format = (cmd.is_opt("shared_format")) ? (std::string)cmd.opt("shared_format"): std::string("dense");
+	
+	if (shared_format != "dense" && shared_format != "sparse" && shared_format != "binary")
+	{
+		std::cout << "Unknown sharing output format: " << shared_format << std::endl;
+		return EXIT_FAILURE;
+	}
+	
+	//
+	// determine pairs counted as sharing
+	//
+	std::string shared_pairs = (cmd.is_opt("shared_pairs")) ? (std::string)cmd.opt("shared_pairs"): std::string("adjacent");
+	
+	if (shared_pairs != "adjacent" && shared_pairs != "all")
+	{
+		std::cout << "Unknown sharing pairs mode: " << shared_pairs << std::endl;
+		return EXIT_FAILURE;
+	}
+	
+	//
+	// determine use of allele counts in INFO column
+	//
+	bool prefilter_info = cmd.is_opt("prefilter_info");
+	bool validate_info  = false;
+	
+	if (prefilter_info && cmd.opt("prefilter_info").count > 0)
+	{
+		const CommandUnit mode = cmd.opt("prefilter_info");
+		
+		if (mode.count > 1)
+		{
+			std::cout << "Expected one INFO prefilter mode, got " << mode.count << std::endl;
+			return EXIT_FAILURE;
+		}
+		
+		if (mode[0] != "validate")
+		{
+			std::cout << "Unknown INFO prefilter mode: " << mode[0] << std::endl;
+			return EXIT_FAILURE;
+		}
+		
+		validate_info = true;
+	}
+	
 	//
 	// create output files
 	//
@@ -96,12 +152,14 @@ int main(int argc, const char * argv[])
 	StreamOut marker_file; // output markers
 	StreamOut sample_file; // output samples
 	StreamOut shared_file; // output sharing
+	StreamOut root_file;   // output breakpoints of shared haplotypes
 	
 	try
 	{
 		marker_file.open(prefix + ".marker");
 		sample_file.open(prefix + ".sample");
-		shared_file.open(prefix + ".shared");
+		shared_file.open(prefix + ".shared" + ((cmd.is_opt("shared_gzip")) ? ".gz": ""), cmd.is_opt("shared_gzip"));
+		root_file.open(prefix + ".root");
 	}
 	catch (const std::exception & x)
 	{
@@ -139,11 +197,24 @@ int main(int argc, const char * argv[])
 	if (cmd.is_opt("threads"))
 		std::cout << std::setw(25) << std::left << "# threads:" << threads << std::endl;
 	
+	if (cmd.is_opt("region"))
+		std::cout << std::setw(25) << std::left << "Region:" << (std::string)cmd.opt("region") << std::endl;
+	
+	if (cmd.is_opt("cache"))
+		std::cout << std::setw(25) << std::left << "Cache file:" << (std::string)cmd.opt("cache") << std::endl;
+	
+	if (cmd.is_opt("shared_format"))
+		std::cout << std::setw(25) << std::left << "Sharing format:" << shared_format << std::endl;
+	
+	if (cmd.is_opt("shared_pairs"))
+		std::cout << std::setw(25) << std::left << "Sharing pairs:" << shared_pairs << std::endl;
+	
 	std::cout << std::setw(25) << std::left << "Rare variant threshold: "  << (std::string)cmd.arg("t") << std::endl;
 	
 	std::cout << std::setw(25) << std::left << "Output files:" << std::endl;
 	std::cout << std::setw(5) << std::left << " " << sample_file.name << std::endl;
 	std::cout << std::setw(5) << std::left << " " << marker_file.name << std::endl;
+	std::cout << std::setw(5) << std::left << " " << root_file.name << std::endl;
 	
 	std::cout << std::endl;
 	
@@ -151,22 +222,87 @@ int main(int argc, const char * argv[])
 	//
 	// Load source data
 	//
-	Source source('m'); // allocate memory for data by marker
+	Source source('m', true); // allocate memory for data by marker, packed into bit-planes
 	
 	try
 	{
-		Input_VCF input(cmd.arg("i"));
+		std::string cache_file;
+		uint64_t    cache_key = 0;
+		
+		// fingerprint of input files & settings affecting loaded data
+		if (cmd.is_opt("cache"))
+		{
+			std::vector<std::string> files = { cmd.arg("i") };
+			std::ostringstream settings;
+			
+			if (cmd.is_arg("s")) files.push_back(cmd.arg("s"));
+			if (cmd.is_arg("m")) files.push_back(cmd.arg("m"));
+			
+			settings << "remove_unknown_markers=" << cmd.is_opt("remove_unknown_markers") << ";";
+			settings << "region=" << (cmd.is_opt("region") ? (std::string)cmd.opt("region"): std::string()) << ";";
+			settings << "prefilter_info=" << prefilter_info << validate_info << ";";
+			
+			cache_file = cmd.opt("cache");
+			cache_key  = stream_fingerprint(files, settings.str());
+		}
 		
-		if (cmd.is_opt("remove_unknown_markers")) input.filter.markerinfo.remove_if_contains_other();
-		input.filter.markergmap.remove_if_source_extrapolated();
-		input.filter.markerdata.remove_if_contains_unknown();
+		Runtime timer;
 		
-		if (cmd.is_arg("s")) input.sample(cmd.arg("s"));
-		if (cmd.is_arg("m")) input.genmap(cmd.arg("m"));
+		bool cached = false;
 		
-		input.run(source, threads);
+		// unreadable cache is a miss, input data is parsed again
+		if (! cache_file.empty())
+		{
+			try
+			{
+				cached = source.load(cache_file, cache_key);
+			}
+			catch (const std::exception & x)
+			{
+				std::clog << "Cannot read cache, input data is parsed again: " << x.what() << std::endl;
+				
+				source = Source('m', true);
+			}
+		}
 		
-		source.finish(threads);
+		if (cached)
+		{
+			std::cout << "Loading input data from cache" << std::endl;
+			std::clog << "Loading input data from cache: " << cache_file << std::endl;
+			
+			Cutoff carrier = cutoff;
+			carrier.scale(source.sample_size() * 2); // two haplotypes per individual
+			
+			source.carrier(carrier, threads); // index carriers of rare haplotypes
+			
+			std::clog << "Done! " << timer.str() << std::endl << std::endl;
+		}
+		else
+		{
+			Input_VCF input(cmd.arg("i"));
+			
+			if (cmd.is_opt("region")) input.region(cmd.opt("region"));
+			
+			if (cmd.is_opt("remove_unknown_markers")) input.filter.markerinfo.remove_if_contains_other();
+			input.filter.markergmap.remove_if_source_extrapolated();
+			input.filter.markerdata.remove_if_contains_unknown();
+			if (prefilter_info) input.filter.markerstat.prefilter_info(validate_info);
+			
+			if (cmd.is_arg("s")) input.sample(cmd.arg("s"));
+			if (cmd.is_arg("m")) input.genmap(cmd.arg("m"));
+			
+			input.carrier(cutoff); // index carriers of rare haplotypes
+			
+			input.run(source, threads);
+			
+			source.finish(threads);
+			
+			if (! cache_file.empty())
+			{
+				source.save(cache_file, cache_key);
+				std::clog << "Input data written to cache: " << cache_file << std::endl << std::endl;
+			}
+		}
 	}
 	catch (std::exception & x)
 	{
@@ -215,9 +351,9 @@ int main(int argc, const char * argv[])
 	
 	for (size_t i = 0; i < source.marker_size(); ++i)
 	{
-		source.marker(i).info.print(marker_file, ' ');
-		source.marker(i).stat.print(marker_file, ' ');
-		source.marker(i).gmap.print(marker_file, '\n');
+		source.marker(i).info().print(marker_file, ' ');
+		source.marker(i).stat().print(marker_file, ' ');
+		source.marker(i).gmap().print(marker_file, '\n');
 	}
 	marker_file.close();
 	std::cout << "OK" << std::endl;
@@ -262,64 +398,79 @@ int main(int argc, const char * argv[])
 	// Identify samples sharing selected variants
 	//
 	{
-		std::vector< std::vector<size_t> > matrix(source.sample_size(), std::vector<size_t>(source.sample_size(), 0));
+		SharedMatrix matrix(source.sample_size(), threads * SHARED_MATRIX_SHARDS);
 		
 		std::cout << "Detecting haplotype sharing" << std::endl;
-		ProgressBar progress(shared.size());
 		
-		for (size_t i = 0, n = shared.size(); i < n; ++i)
-		{
-			progress.update();
-			
-			shared.at(i).subsample(source); // detect subsample
-			
-			size_t nsub = shared[i].type.sample_id.size();
-			
-			if (nsub > 1) // exclude doubletons in same individual
-			{
-				for (size_t k0 = 0, k1 = 1; k1 < nsub; ++k0, ++k1)
-				{
-					const size_t x = shared[i].type.sample_id[k0];
-					const size_t y = shared[i].type.sample_id[k1];
-					
-					++matrix[x][y];
-					++matrix[y][x];
-				}
-			}
-		}
+		shared.share(source, matrix, threads, shared_pairs == "all");
 		
-		progress.finish();
 		std::cout << std::endl;
 		
+		std::clog << "Sample pairs sharing haplotypes: " << matrix.nonzero() << " (" << matrix.dense_shards() << " of " << matrix.shards() << " shards dense)" << std::endl;
+		
 		std::cout << "Writing sharing information ... " << std::flush;
 		
-		// print header columns
-		fprintf(shared_file, ".");
-		for (size_t x = 0; x < source.sample_size(); ++x)
+		try
 		{
-			fprintf(shared_file, " %s", source.sample(x).info.key.c_str());
+			if (shared_format == "sparse")
+				matrix.print_sparse(shared_file, source);
+			else if (shared_format == "binary")
+				matrix.print_binary(shared_file);
+			else
+				matrix.print_dense(shared_file, source);
+			
+			shared_file.close();
 		}
-		shared_file.endl();
-		
-		for (size_t x = 0; x < source.sample_size(); ++x)
+		catch (const std::exception & x)
 		{
-			fprintf(shared_file, "%s", source.sample(x).info.key.c_str()); // print sample ID in row
-			
-			for (size_t y = 0; y < source.sample_size(); ++y)
-			{
-				fprintf(shared_file, " %lu", matrix[x][y]);
-			}
-			shared_file.endl();
+			return error("Error while writing sharing information", x);
 		}
 		
-		shared_file.close();
 		std::cout << "OK" << std::endl;
 		std::cout << std::endl;
 	}
 	
 	
 	
-	shared.scan(source, threads);
+	//
+	// Scan shared haplotype structures
+	//
+	if (cmd.is_opt("tiled"))
+	{
+		std::cout << "Building sample-major tiles ... " << std::flush;
+		
+		Runtime timer;
+		
+		source.tile(threads);
+		
+		std::clog << "Sample-major tiles built in " << timer.str() << std::endl;
+		std::cout << "OK" << std::endl;
+	}
+	
+	std::cout << "Scanning shared haplotypes" << std::endl;
+	
+	try
+	{
+		shared.scan(source, threads, &root_file, cmd.is_opt("trees")); // keep trees only if written
+		
+		root_file.close();
+	}
+	catch (const std::exception & x)
+	{
+		return error("Error while writing breakpoints of shared haplotypes", x);
+	}
+	
+	if (cmd.is_opt("trees"))
+	{
+		try
+		{
+			shared.save(cmd.opt("trees"));
+		}
+		catch (const std::exception & x)
+		{
+			return error("Error while writing shared haplotype trees", x);
+		}
+	}
 
 	
 	
@@ -22,20 +22,31 @@ MarkerData::MarkerData(const size_t _size)
 , n(_size)
 , i(0)
 , contains_unknown_(false)
+, packed_(false)
 {}
 
 MarkerData::MarkerData(const MarkerData & other)
 : data(other.data)
+, plane0(other.plane0)
+, plane1(other.plane1)
+, other_index(other.other_index)
+, other_value(other.other_value)
 , n(other.n)
 , i(other.i)
 , contains_unknown_(other.contains_unknown_)
+, packed_(other.packed_)
 {}
 
 MarkerData::MarkerData(MarkerData && other)
 : data(std::move(other.data))
+, plane0(std::move(other.plane0))
+, plane1(std::move(other.plane1))
+, other_index(std::move(other.other_index))
+, other_value(std::move(other.other_value))
 , n(other.n)
 , i(other.i)
 , contains_unknown_(other.contains_unknown_)
+, packed_(other.packed_)
 {}
 
 MarkerData & MarkerData::operator = (const MarkerData & other)
@@ -43,9 +54,14 @@ MarkerData & MarkerData::operator = (const MarkerData & other)
 	if (this != &other)
 	{
 		this->data = other.data;
+		this->plane0 = other.plane0;
+		this->plane1 = other.plane1;
+		this->other_index = other.other_index;
+		this->other_value = other.other_value;
 		this->n = other.n;
 		this->i = other.i;
 		this->contains_unknown_ = other.contains_unknown_;
+		this->packed_ = other.packed_;
 	}
 	return *this;
 }
@@ -55,14 +71,19 @@ MarkerData & MarkerData::operator = (MarkerData && other)
 	if (this != &other)
 	{
 		this->data.swap(other.data);
+		this->plane0.swap(other.plane0);
+		this->plane1.swap(other.plane1);
+		this->other_index.swap(other.other_index);
+		this->other_value.swap(other.other_value);
 		this->n = other.n;
 		this->i = other.i;
 		this->contains_unknown_ = other.contains_unknown_;
+		this->packed_ = other.packed_;
 	}
 	return *this;
 }
 
-bool MarkerData::append(const Genotype & g)
+bool MarkerData::append(const Genotype & g, size_t * count)
 {
 	if (this->i < this->n)
 	{
@@ -74,7 +95,14 @@ bool MarkerData::append(const Genotype & g)
 			}
 		}
 		
-		this->data[this->i++] = g; // append
+		this->data[this->i] = g; // append
+		
+		if (count != NULL)
+		{
+			++count[ this->data[this->i].raw() ];
+		}
+		
+		++this->i;
 		
 		return true;
 	}
@@ -82,9 +110,107 @@ bool MarkerData::append(const Genotype & g)
 	return false;
 }
 
+bool MarkerData::append(const unsigned char * raw, const size_t size, size_t * count)
+{
+	if (this->i + size > this->n)
+	{
+		return false;
+	}
+	
+	for (size_t k = 0; k < size; ++k)
+	{
+		if ((raw[k] >> 4) == Haplotype::unknown || (raw[k] & 0x0F) == Haplotype::unknown)
+		{
+			this->contains_unknown_ = true;
+		}
+		
+		if (count != NULL)
+		{
+			++count[ raw[k] ];
+		}
+		
+		this->data[this->i++] = Datatype(raw[k]); // append
+	}
+	
+	return true;
+}
+
+void MarkerData::save(StreamBinaryOut & out) const
+{
+#ifdef DEBUG_MARKER
+	if (! this->is_complete())
+	{
+		throw std::logic_error("Marker data is not complete");
+	}
+#endif
+	
+	std::vector<unsigned char> raw;
+	
+	out.put<uint64_t>(this->n);
+	out.put<uint8_t>(this->contains_unknown_);
+	out.put<uint8_t>(this->packed_);
+	
+	if (this->packed_)
+	{
+		out.put(this->plane0);
+		out.put(this->plane1);
+		out.put(this->other_index);
+		
+		for (const Datatype & d : this->other_value)
+			raw.push_back(d.raw());
+	}
+	else
+	{
+		for (const Datatype & d : this->data)
+			raw.push_back(d.raw());
+	}
+	
+	out.put(raw);
+}
+
+void MarkerData::load(StreamBinaryIn & in)
+{
+	std::vector<unsigned char> raw;
+	
+	this->remove();
+	
+	this->n = in.get<uint64_t>();
+	this->i = this->n;
+	this->contains_unknown_ = (in.get<uint8_t>() != 0);
+	this->packed_ = (in.get<uint8_t>() != 0);
+	
+	if (this->packed_)
+	{
+		in.get(this->plane0);
+		in.get(this->plane1);
+		in.get(this->other_index);
+		in.get(raw);
+		
+		const size_t words = (this->n + 63) / 64;
+		
+		if (this->plane0.size() != words || this->plane1.size() != words || raw.size() != this->other_index.size())
+			throw std::runtime_error("Invalid marker data in snapshot");
+		
+		this->other_value.reserve(raw.size());
+		for (const unsigned char r : raw)
+			this->other_value.push_back(Datatype(r));
+	}
+	else
+	{
+		in.get(raw);
+		
+		if (raw.size() != this->n)
+			throw std::runtime_error("Invalid marker data in snapshot");
+		
+		this->data.reserve(raw.size());
+		for (const unsigned char r : raw)
+			this->data.push_back(Datatype(r));
+	}
+}
+
 bool MarkerData::erase(const size_t _i)
 {
-	if (_i >= this->i)
+	if (_i >= this->i || this->packed_)
 	{
 		return false;
 	}
@@ -102,9 +228,19 @@ void MarkerData::remove()
 	std::vector<Datatype> x;
 	this->data.swap(x);
 	
+	std::vector<uint64_t> p0, p1;
+	this->plane0.swap(p0);
+	this->plane1.swap(p1);
+	
+	std::vector<uint32_t> oi;
+	std::vector<Datatype> ov;
+	this->other_index.swap(oi);
+	this->other_value.swap(ov);
+	
 	this->n = 0;
 	this->i = 0;
 	this->contains_unknown_ = false;
+	this->packed_ = false;
 }
 
 size_t MarkerData::size() const
@@ -127,6 +263,122 @@ bool MarkerData::contains_unknown() const
 	return this->contains_unknown_;
 }
 
+bool MarkerData::is_packed() const
+{
+	return this->packed_;
+}
+
+bool MarkerData::is_binary() const
+{
+	return (this->packed_ && this->other_index.empty());
+}
+
+void MarkerData::gather(const uint32_t * sample, const size_t n, uint64_t * b0, uint64_t * b1) const
+{
+#ifdef DEBUG_MARKER
+	if (! this->is_binary())
+	{
+		throw std::logic_error("Marker data is not binary");
+	}
+#endif
+	
+	const uint64_t * p0 = this->plane0.data();
+	const uint64_t * p1 = this->plane1.data();
+	
+	for (size_t w = 0, i = 0; i < n; ++w)
+	{
+		uint64_t x0 = 0, x1 = 0;
+		
+		for (size_t k = 0; k < 64 && i < n; ++k, ++i)
+		{
+			const size_t x = sample[i];
+			
+			x0 |= ((p0[x >> 6] >> (x & 63)) & 1) << k;
+			x1 |= ((p1[x >> 6] >> (x & 63)) & 1) << k;
+		}
+		
+		b0[w] = x0;
+		b1[w] = x1;
+	}
+}
+
+const uint64_t * MarkerData::plane(const int k) const
+{
+#ifdef DEBUG_MARKER
+	if (! this->packed_)
+	{
+		throw std::logic_error("Marker data is not packed");
+	}
+#endif
+	
+	return (k == 0) ? this->plane0.data(): this->plane1.data();
+}
+
+bool MarkerData::pack()
+{
+#ifdef DEBUG_MARKER
+	if (! this->is_complete())
+	{
+		throw std::logic_error("Marker data is not complete");
+	}
+#endif
+	
+	if (this->packed_)
+		return true;
+	
+	if (this->n == 0 || this->n > UINT32_MAX)
+		return false;
+	
+	const size_t limit = this->n / 8; // keep byte array if too many genotypes do not fit
+	size_t k;
+	
+	// count genotypes not fitting bit-planes
+	k = 0;
+	for (size_t x = 0; x < this->n; ++x)
+	{
+		const Genotype g = this->data[x];
+		
+		if ((int)g.h0 > 1 || (int)g.h1 > 1) // multiallelic or unknown
+		{
+			if (++k > limit)
+				return false;
+		}
+	}
+	
+	const size_t words = (this->n + 63) / 64;
+	
+	this->plane0.assign(words, 0);
+	this->plane1.assign(words, 0);
+	this->other_index.reserve(k);
+	this->other_value.reserve(k);
+	
+	// fill bit-planes & side table
+	for (size_t x = 0; x < this->n; ++x)
+	{
+		const Genotype g = this->data[x];
+		const int h0 = (int)g.h0;
+		const int h1 = (int)g.h1;
+		
+		if (h0 > 1 || h1 > 1)
+		{
+			this->other_index.push_back(static_cast<uint32_t>(x));
+			this->other_value.push_back(this->data[x]);
+			continue;
+		}
+		
+		this->plane0[x >> 6] |= static_cast<uint64_t>(h0) << (x & 63);
+		this->plane1[x >> 6] |= static_cast<uint64_t>(h1) << (x & 63);
+	}
+	
+	// release byte array
+	std::vector<Datatype> x;
+	this->data.swap(x);
+	
+	this->packed_ = true;
+	
+	return true;
+}
+
 Genotype MarkerData::operator [] (const size_t _i) const
 {
 #ifdef DEBUG_MARKER
@@ -136,7 +388,24 @@ Genotype MarkerData::operator [] (const size_t _i) const
 	}
 #endif
 	
-	return this->data[_i];
+	if (! this->packed_)
+	{
+		return this->data[_i];
+	}
+	
+	// look up side table
+	if (! this->other_index.empty())
+	{
+		std::vector<uint32_t>::const_iterator it = std::lower_bound(this->other_index.cbegin(), this->other_index.cend(), static_cast<uint32_t>(_i));
+		
+		if (it != this->other_index.cend() && *it == _i)
+		{
+			return this->other_value[ it - this->other_index.cbegin() ];
+		}
+	}
+	
+	return Genotype(Haplotype(static_cast<int>((this->plane0[_i >> 6] >> (_i & 63)) & 1)),
+					Haplotype(static_cast<int>((this->plane1[_i >> 6] >> (_i & 63)) & 1)));
 }
 
 void MarkerData::print(std::ostream & stream, const char last) const
@@ -150,13 +419,13 @@ void MarkerData::print(std::ostream & stream, const char last) const
 	
 	if (this->i > 0)
 	{
-		Genotype g = this->data[0];
+		Genotype g = (*this)[0];
 		
 		stream << g.h0.str() << ' ' << g.h1.str();
 		
 		for (size_t k = 1; k < this->n; ++k)
 		{
-			g = this->data[k];
+			g = (*this)[k];
 			
 			stream << ' ' << g.h0.str() << ' ' << g.h1.str();
 		}
@@ -181,13 +450,13 @@ void MarkerData::print(FILE * fp, const char last) const
 	
 	if (this->i > 0)
 	{
-		Genotype g = this->data[0];
+		Genotype g = (*this)[0];
 		
 		fprintf(fp, "%s %s", g.h0.str().c_str(), g.h1.str().c_str());
 		
 		for (size_t k = 1; k < this->n; ++k)
 		{
-			g = this->data[k];
+			g = (*this)[k];
 			
 			fprintf(fp, " %s %s", g.h0.str().c_str(), g.h1.str().c_str());
 		}
@@ -293,33 +562,47 @@ const std::string MarkerInfo::header = "chromosome position marker_id n_alleles
 
 MarkerStat::MarkerStat()
 : evaluated(false)
-{}
+, n_allele(0)
+, size_(0)
+, unknown_haplotype_(0)
+, unknown_genotype_(0)
+{
+	std::fill(this->inline_, this->inline_ + MARKER_STAT_INLINE, 0);
+}
 
 MarkerStat::MarkerStat(const MarkerStat & other)
 : evaluated(other.evaluated)
-, haplotype(other.haplotype)
-, genotype(other.genotype)
-, unknown_haplotype(other.unknown_haplotype)
-, unknown_genotype(other.unknown_genotype)
-{}
+, n_allele(other.n_allele)
+, size_(other.size_)
+, unknown_haplotype_(other.unknown_haplotype_)
+, unknown_genotype_(other.unknown_genotype_)
+, spill_(other.spill_)
+{
+	std::copy(other.inline_, other.inline_ + MARKER_STAT_INLINE, this->inline_);
+}
 
 MarkerStat::MarkerStat(MarkerStat && other)
 : evaluated(other.evaluated)
-, haplotype(std::move(other.haplotype))
-, genotype(std::move(other.genotype))
-, unknown_haplotype(std::move(other.unknown_haplotype))
-, unknown_genotype(std::move(other.unknown_genotype))
-{}
+, n_allele(other.n_allele)
+, size_(other.size_)
+, unknown_haplotype_(other.unknown_haplotype_)
+, unknown_genotype_(other.unknown_genotype_)
+, spill_(std::move(other.spill_))
+{
+	std::copy(other.inline_, other.inline_ + MARKER_STAT_INLINE, this->inline_);
+}
 
 MarkerStat & MarkerStat::operator = (const MarkerStat & other)
 {
 	if (this != &other)
 	{
 		this->evaluated = other.evaluated;
-		this->haplotype = other.haplotype;
-		this->genotype  = other.genotype;
-		this->unknown_haplotype = other.unknown_haplotype;
-		this->unknown_genotype  = other.unknown_genotype;
+		this->n_allele  = other.n_allele;
+		this->size_     = other.size_;
+		this->unknown_haplotype_ = other.unknown_haplotype_;
+		this->unknown_genotype_  = other.unknown_genotype_;
+		this->spill_ = other.spill_;
+		std::copy(other.inline_, other.inline_ + MARKER_STAT_INLINE, this->inline_);
 	}
 	return *this;
 }
@@ -329,21 +612,32 @@ MarkerStat & MarkerStat::operator = (MarkerStat && other)
 	if (this != &other)
 	{
 		this->evaluated = other.evaluated;
-		this->haplotype = std::move(other.haplotype);
-		this->genotype  = std::move(other.genotype);
-		this->unknown_haplotype = std::move(other.unknown_haplotype);
-		this->unknown_genotype  = std::move(other.unknown_genotype);
+		this->n_allele  = other.n_allele;
+		this->size_     = other.size_;
+		this->unknown_haplotype_ = other.unknown_haplotype_;
+		this->unknown_genotype_  = other.unknown_genotype_;
+		this->spill_ = std::move(other.spill_);
+		std::copy(other.inline_, other.inline_ + MARKER_STAT_INLINE, this->inline_);
 	}
 	return *this;
 }
 
+const uint32_t * MarkerStat::table() const
+{
+	return (this->spill_.empty()) ? this->inline_: this->spill_.data();
+}
+
+int MarkerStat::index(const int i0, const int i1) const
+{
+	const int a = std::min(i0, i1);
+	const int b = std::max(i0, i1);
+	
+	return a * this->n_allele - (a * (a - 1)) / 2 + (b - a); // genotypes before 1st allele, then offset
+}
+
 bool MarkerStat::evaluate(const MarkerInfo & info, const MarkerData & data)
 {
 #ifdef DEBUG_MARKER
-	if (this->evaluated)
-	{
-		throw std::logic_error("Marker statistics already calculated");
-	}
 	if (! data.is_complete())
 	{
 		throw std::logic_error("Marker data is not complete");
@@ -352,112 +646,219 @@ bool MarkerStat::evaluate(const MarkerInfo & info, const MarkerData & data)
 	
 	const size_t size = data.size();
 	
+	size_t count[ MARKER_STAT_VALUES ] = { 0 }; // genotype counts by raw value
+	
+	// walkabout data
+	for (size_t i = 0; i < size; ++i)
+	{
+		++count[ Datatype(data[i]).raw() ];
+	}
+	
+	return this->evaluate(info, count, size);
+}
+
+bool MarkerStat::evaluate(const MarkerInfo & info, const size_t * count, const size_t size)
+{
+#ifdef DEBUG_MARKER
+	if (this->evaluated)
+	{
+		throw std::logic_error("Marker statistics already calculated");
+	}
+#endif
+	
 	size_t count_h[ Haplotype::unknown ] = { 0 }; // haplotype counts
 	size_t count_g[ Haplotype::unknown ][ Haplotype::unknown ] = { 0 }; // genotype counts
+	size_t unknown_h = 0, unknown_g = 0;
 	
-	int       i0, i1;
-	Haplotype h0, h1;
-	bool flag;
+	int i0, i1;
 	
-	// walkabout data
-	for (size_t i = 0; i < size; ++i)
+	// walkabout raw values
+	for (int v = 0; v < MARKER_STAT_VALUES; ++v)
 	{
-		h0 = data[i].h0;
-		h1 = data[i].h1;
+		const size_t c = count[v];
 		
-		i0 = (int)h0;
-		i1 = (int)h1;
+		if (c == 0)
+			continue;
 		
-		flag = false;
+		i0 = v >> 4;
+		i1 = v & 0x0F;
+		
+		const bool u0 = (i0 == Haplotype::unknown);
+		const bool u1 = (i1 == Haplotype::unknown);
 		
 		// count first haplotype
-		if (h0.is_unknown())
-		{
-			++unknown_haplotype; // missing/undefined allele
-			flag = true;
-		}
+		if (u0)
+			unknown_h += c; // missing/undefined allele
+		else if (info.allele.exists(i0)) // check if allele is defined
+			count_h[ i0 ] += c;
 		else
-		{
-			if (info.allele.exists(i0)) // check if allele is defined
-				++count_h[ i0 ];
-			else
-				return false;
-		}
+			return false;
 		
 		// count second haplotype
-		if (h1.is_unknown())
-		{
-			++this->unknown_haplotype; // missing/undefined allele
-			flag = true;
-		}
+		if (u1)
+			unknown_h += c; // missing/undefined allele
+		else if (info.allele.exists(i1)) // check if allele is defined
+			count_h[ i1 ] += c;
 		else
-		{
-			if (info.allele.exists(i1)) // check if allele is defined
-				++count_h[ i1 ];
-			else
-				return false;
-		}
+			return false;
 		
 		// count genotype (unphased, sorted)
-		if (flag)
-		{
-			++this->unknown_genotype;
-		}
+		if (u0 || u1)
+			unknown_g += c;
 		else
-		{
-			++count_g[ std::min(i0, i1) ][ std::max(i0, i1) ];
-		}
+			count_g[ std::min(i0, i1) ][ std::max(i0, i1) ] += c;
+	}
+	
+	const int n = info.allele.size();
+	const int n_count = n + (n * (n + 1)) / 2;
+	
+	this->n_allele  = static_cast<uint8_t>(n);
+	this->size_     = static_cast<uint32_t>(size);
+	this->unknown_haplotype_ = static_cast<uint32_t>(unknown_h);
+	this->unknown_genotype_  = static_cast<uint32_t>(unknown_g);
+	
+	if (n_count > MARKER_STAT_INLINE)
+	{
+		this->spill_.resize(n_count);
 	}
 	
+	uint32_t * out = (this->spill_.empty()) ? this->inline_: this->spill_.data();
 	
 	// insert haplotype count
-	for (int h = 0; h < info.allele.size(); ++h)
+	for (int h = 0; h < n; ++h)
 	{
-		this->haplotype.append(Haplotype(h), Census(count_h[ h ], size * 2));  // scale: two haplotypes per genotype
+		*out++ = static_cast<uint32_t>(count_h[ h ]);
 	}
 	
 	// insert genotype count
-	for (i0 = 0; i0 < info.allele.size(); ++i0)
+	for (i0 = 0; i0 < n; ++i0)
 	{
-		h0 = i0;
-		
-		for (i1 = i0; i1 < info.allele.size(); ++i1)
+		for (i1 = i0; i1 < n; ++i1)
 		{
-			h1 = i1;
-			this->genotype.append(Genotype(h0, h1), Census(count_g[ i0 ][ i1 ], size));
+			*out++ = static_cast<uint32_t>(count_g[ i0 ][ i1 ]);
 		}
 	}
 	
-	this->unknown_haplotype.scale(size * 2);
-	this->unknown_genotype.scale(size);
-	
 	this->evaluated = true;
 	
 	return true;
 }
 
-const Census & MarkerStat::operator [] (const Haplotype & h) const
+void MarkerStat::save(StreamBinaryOut & out) const
+{
+#ifdef DEBUG_MARKER
+	if (!this->evaluated)
+	{
+		throw std::logic_error("Marker statistics not calculated");
+	}
+#endif
+	
+	const int n_count = this->n_allele + this->genotype_size();
+	
+	out.put<uint8_t>(this->n_allele);
+	out.put<uint32_t>(this->size_);
+	out.put<uint32_t>(this->unknown_haplotype_);
+	out.put<uint32_t>(this->unknown_genotype_);
+	out.put(std::vector<uint32_t>(this->table(), this->table() + n_count));
+}
+
+void MarkerStat::load(StreamBinaryIn & in)
+{
+	std::vector<uint32_t> counts;
+	
+	this->n_allele = in.get<uint8_t>();
+	this->size_    = in.get<uint32_t>();
+	this->unknown_haplotype_ = in.get<uint32_t>();
+	this->unknown_genotype_  = in.get<uint32_t>();
+	
+	in.get(counts);
+	
+	if (counts.size() != static_cast<size_t>(this->n_allele + this->genotype_size()))
+		throw std::runtime_error("Invalid marker stats in snapshot");
+	
+	this->spill_.clear();
+	
+	if (counts.size() > MARKER_STAT_INLINE)
+		this->spill_.swap(counts);
+	else
+		std::copy(counts.begin(), counts.end(), this->inline_);
+	
+	this->evaluated = true;
+}
+
+int MarkerStat::haplotype_size() const
+{
+	return this->n_allele;
+}
+
+int MarkerStat::genotype_size() const
+{
+	return (this->n_allele * (this->n_allele + 1)) / 2;
+}
+
+Census MarkerStat::haplotype(const int i) const
 {
 #ifdef DEBUG_MARKER
 	if (!this->evaluated)
 	{
 		throw std::logic_error("Marker statistics not calculated");
 	}
+	if (i < 0 || i >= this->n_allele)
+	{
+		throw std::out_of_range("Census index out of range");
+	}
 #endif
 	
-	return this->haplotype[h];
+	return Census(this->table()[ i ], static_cast<size_t>(this->size_) * 2); // scale: two haplotypes per genotype
 }
 
-const Census & MarkerStat::operator [] (const Genotype & g) const
+Census MarkerStat::genotype(const int i) const
 {
 #ifdef DEBUG_MARKER
 	if (!this->evaluated)
 	{
 		throw std::logic_error("Marker statistics not calculated");
 	}
+	if (i < 0 || i >= this->genotype_size())
+	{
+		throw std::out_of_range("Census index out of range");
+	}
 #endif
 	
-	return this->genotype[ Genotype(std::min(g.h0, g.h1), std::max(g.h0, g.h1)) ];
+	return Census(this->table()[ this->n_allele + i ], this->size_);
+}
+
+Genotype MarkerStat::genotype_type(const int i) const
+{
+	int a = 0, k = i;
+	
+	while (k >= this->n_allele - a)
+	{
+		k -= this->n_allele - a;
+		++a;
+	}
+	
+	return Genotype(Haplotype(a), Haplotype(a + k));
+}
+
+Census MarkerStat::unknown_haplotype() const
+{
+	return Census(this->unknown_haplotype_, static_cast<size_t>(this->size_) * 2);
+}
+
+Census MarkerStat::unknown_genotype() const
+{
+	return Census(this->unknown_genotype_, this->size_);
+}
+
+Census MarkerStat::operator [] (const Haplotype & h) const
+{
+	return this->haplotype((int)h);
+}
+
+Census MarkerStat::operator [] (const Genotype & g) const
+{
+	return this->genotype(this->index((int)g.h0, (int)g.h1));
 }
 
 void MarkerStat::print(std::ostream & stream, const char last) const
@@ -473,14 +874,14 @@ void MarkerStat::print(std::ostream & stream, const char last) const
 	Genotype g;
 	
 	int i;
-	const int h_size = this->haplotype.size();
-	const int g_size = this->genotype.size();
+	const int h_size = this->haplotype_size();
+	const int g_size = this->genotype_size();
 	
 	// allele_count
 	sep = NULL;
 	for (i = 0; i < h_size; ++i)
 	{
-		stream << sep << i << ':' << (size_t)this->haplotype.census(i);
+		stream << sep << i << ':' << (size_t)this->haplotype(i);
 		sep = ',';
 	}
 	stream << " ";
@@ -489,23 +890,23 @@ void MarkerStat::print(std::ostream & stream, const char last) const
 	sep = NULL;
 	for (i = 0; i < h_size; ++i)
 	{
-		stream << sep << i << ':' << std::setprecision(6) << (double)this->haplotype.census(i);
+		stream << sep << i << ':' << std::setprecision(6) << (double)this->haplotype(i);
 		sep = ',';
 	}
 	stream << " ";
 	
 	// miss_allele_count
-	stream << (size_t)this->unknown_haplotype << " ";
+	stream << (size_t)this->unknown_haplotype() << " ";
 	
 	// miss_allele_freq
-	stream << std::setprecision(6) << (double)this->unknown_haplotype << " ";
+	stream << std::setprecision(6) << (double)this->unknown_haplotype() << " ";
 	
 	// genotype_count
 	sep = NULL;
 	for (i = 0; i < g_size; ++i)
 	{
-		g = this->genotype.type(i);
-		stream << sep << g.h0.str() << '/' << g.h1.str() << ':' << (size_t)this->genotype.census(i);
+		g = this->genotype_type(i);
+		stream << sep << g.h0.str() << '/' << g.h1.str() << ':' << (size_t)this->genotype(i);
 		sep = ',';
 	}
 	stream << " ";
@@ -514,17 +915,17 @@ void MarkerStat::print(std::ostream & stream, const char last) const
 	sep = NULL;
 	for (i = 0; i < g_size; ++i)
 	{
-		g = this->genotype.type(i);
-		stream << sep << g.h0.str() << '/' << g.h1.str() << ':' << std::setprecision(6) << (double)this->genotype.census(i);
+		g = this->genotype_type(i);
+		stream << sep << g.h0.str() << '/' << g.h1.str() << ':' << std::setprecision(6) << (double)this->genotype(i);
 		sep = ',';
 	}
 	stream << " ";
 	
 	// miss_allele_count
-	stream << (size_t)this->unknown_genotype << " ";
+	stream << (size_t)this->unknown_genotype() << " ";
 	
 	// miss_allele_freq
-	stream << std::setprecision(6) << (double)this->unknown_genotype;
+	stream << std::setprecision(6) << (double)this->unknown_genotype();
 	
 	if (last != '\0')
 		stream << last;
@@ -542,42 +943,42 @@ void MarkerStat::print(FILE * fp, const char last) const
 	Genotype g;
 	
 	int i;
-	const int h_size = this->haplotype.size();
-	const int g_size = this->genotype.size();
+	const int h_size = this->haplotype_size();
+	const int g_size = this->genotype_size();
 	
 	// allele_count
-	fprintf(fp, "0:%lu", (size_t)this->haplotype.census(0));
+	fprintf(fp, "0:%lu", (size_t)this->haplotype(0));
 	for (i = 1; i < h_size; ++i)
-		fprintf(fp, ",%d:%lu", i, (size_t)this->haplotype.census(i));
+		fprintf(fp, ",%d:%lu", i, (size_t)this->haplotype(i));
 	
 	// allele_freq
-	fprintf(fp, " 0:%0.6f", (double)this->haplotype.census(0));
+	fprintf(fp, " 0:%0.6f", (double)this->haplotype(0));
 	for (i = 1; i < h_size; ++i)
-		fprintf(fp, ",%d:%0.6f", i, (double)this->haplotype.census(i));
+		fprintf(fp, ",%d:%0.6f", i, (double)this->haplotype(i));
 	
 	// miss_allele_count + miss_allele_freq
-	fprintf(fp, " %lu %0.6f", (size_t)this->unknown_haplotype, (double)this->unknown_haplotype);
+	fprintf(fp, " %lu %0.6f", (size_t)this->unknown_haplotype(), (double)this->unknown_haplotype());
 	
 	// genotype_count
-	g = this->genotype.type(0);
-	fprintf(fp, " %s/%s:%lu", g.h0.str().c_str(), g.h1.str().c_str(), (size_t)this->genotype.census(0));
+	g = this->genotype_type(0);
+	fprintf(fp, " %s/%s:%lu", g.h0.str().c_str(), g.h1.str().c_str(), (size_t)this->genotype(0));
 	for (i = 1; i < g_size; ++i)
 	{
-		g = this->genotype.type(i);
-		fprintf(fp, ",%s/%s:%lu", g.h0.str().c_str(), g.h1.str().c_str(), (size_t)this->genotype.census(i));
+		g = this->genotype_type(i);
+		fprintf(fp, ",%s/%s:%lu", g.h0.str().c_str(), g.h1.str().c_str(), (size_t)this->genotype(i));
 	}
 	
 	// genotype_freq
-	g = this->genotype.type(0);
-	fprintf(fp, " %s/%s:%0.6f", g.h0.str().c_str(), g.h1.str().c_str(), (double)this->genotype.census(0));
+	g = this->genotype_type(0);
+	fprintf(fp, " %s/%s:%0.6f", g.h0.str().c_str(), g.h1.str().c_str(), (double)this->genotype(0));
 	for (i = 1; i < g_size; ++i)
 	{
-		g = this->genotype.type(i);
-		fprintf(fp, ",%s/%s:%0.6f", g.h0.str().c_str(), g.h1.str().c_str(), (double)this->genotype.census(i));
+		g = this->genotype_type(i);
+		fprintf(fp, ",%s/%s:%0.6f", g.h0.str().c_str(), g.h1.str().c_str(), (double)this->genotype(i));
 	}
 	
 	// miss_genotype_count + miss_genotype_freq
-	fprintf(fp, " %lu %0.6f", (size_t)this->unknown_genotype, (double)this->unknown_genotype);
+	fprintf(fp, " %lu %0.6f", (size_t)this->unknown_genotype(), (double)this->unknown_genotype());
 	
 	if (last != '\0')
 		fprintf(fp, "%c", last);
@@ -593,6 +994,148 @@ std::string MarkerStat::str() const
 const std::string MarkerStat::header = "allele_count allele_freq miss_allele_count miss_allele_freq genotype_count genotype_freq miss_genotype_count miss_genotype_freq";
 
 
+//
+// Marker carriers of rare haplotypes
+//
+
+MarkerCarrier::MarkerCarrier()
+{}
+
+MarkerCarrier::MarkerCarrier(const MarkerCarrier & other)
+: haplotype_(other.haplotype_)
+, offset_(other.offset_)
+, sample_id_(other.sample_id_)
+{}
+
+MarkerCarrier::MarkerCarrier(MarkerCarrier && other)
+: haplotype_(std::move(other.haplotype_))
+, offset_(std::move(other.offset_))
+, sample_id_(std::move(other.sample_id_))
+{}
+
+MarkerCarrier & MarkerCarrier::operator = (const MarkerCarrier & other)
+{
+	if (this != &other)
+	{
+		this->haplotype_ = other.haplotype_;
+		this->offset_    = other.offset_;
+		this->sample_id_ = other.sample_id_;
+	}
+	return *this;
+}
+
+MarkerCarrier & MarkerCarrier::operator = (MarkerCarrier && other)
+{
+	if (this != &other)
+	{
+		this->haplotype_.swap(other.haplotype_);
+		this->offset_.swap(other.offset_);
+		this->sample_id_.swap(other.sample_id_);
+	}
+	return *this;
+}
+
+void MarkerCarrier::evaluate(const MarkerStat & stat, const MarkerData & data, const Census & cutoff)
+{
+#ifdef DEBUG_MARKER
+	if (! this->haplotype_.empty())
+	{
+		throw std::logic_error("Marker carriers already indexed");
+	}
+#endif
+	
+	int select[ Haplotype::unknown + 1 ]; // position of haplotype in index, or -1
+	
+	std::fill(select, select + Haplotype::unknown + 1, -1);
+	
+	// select rare haplotypes
+	for (int k = 0; k < stat.haplotype_size(); ++k)
+	{
+		const Census census = stat.haplotype(k);
+		
+		if (census > size_t(0) && census <= cutoff)
+		{
+			select[ k ] = static_cast<int>(this->haplotype_.size());
+			this->haplotype_.push_back(Haplotype(k));
+		}
+	}
+	
+	if (this->haplotype_.empty())
+		return;
+	
+#ifdef DEBUG_MARKER
+	if (data.size() > UINT32_MAX)
+	{
+		throw std::out_of_range("Sample ID exceeds carrier index");
+	}
+#endif
+	
+	const size_t n_select = this->haplotype_.size();
+	const size_t n = data.size();
+	
+	// count carriers of each haplotype
+	this->offset_.assign(n_select + 1, 0);
+	
+	for (size_t i = 0; i < n; ++i)
+	{
+		const Genotype g = data[i];
+		const int s0 = select[ (int)g.h0 ];
+		const int s1 = select[ (int)g.h1 ];
+		
+		if (s0 != -1)
+			++this->offset_[s0 + 1];
+		
+		if (s1 != -1 && g.h1 != g.h0)
+			++this->offset_[s1 + 1];
+	}
+	
+	for (size_t k = 0; k < n_select; ++k)
+		this->offset_[k + 1] += this->offset_[k];
+	
+	// pool carriers in sample order
+	std::vector<uint32_t> next(this->offset_.cbegin(), this->offset_.cend() - 1);
+	
+	this->sample_id_.resize(this->offset_.back());
+	
+	for (size_t i = 0; i < n; ++i)
+	{
+		const Genotype g = data[i];
+		const int s0 = select[ (int)g.h0 ];
+		const int s1 = select[ (int)g.h1 ];
+		
+		if (s0 != -1)
+			this->sample_id_[ next[s0]++ ] = static_cast<uint32_t>(i);
+		
+		if (s1 != -1 && g.h1 != g.h0)
+			this->sample_id_[ next[s1]++ ] = static_cast<uint32_t>(i);
+	}
+}
+
+bool MarkerCarrier::contains(const Haplotype & h) const
+{
+	return (std::find(this->haplotype_.cbegin(), this->haplotype_.cend(), h) != this->haplotype_.cend());
+}
+
+const uint32_t * MarkerCarrier::find(const Haplotype & h, size_t & n) const
+{
+	std::vector<Haplotype>::const_iterator it = std::find(this->haplotype_.cbegin(), this->haplotype_.cend(), h);
+	
+	if (it == this->haplotype_.cend())
+		return NULL;
+	
+	const size_t k = it - this->haplotype_.cbegin();
+	
+	n = this->offset_[k + 1] - this->offset_[k];
+	
+	return this->sample_id_.data() + this->offset_[k];
+}
+
+int MarkerCarrier::size() const
+{
+	return static_cast<int>(this->haplotype_.size());
+}
+
+
 //
 // Marker in genetic map
 //
@@ -680,6 +1223,7 @@ Marker::Marker(const Marker & other)
 , stat(other.stat)
 , gmap(other.gmap)
 , data(other.data)
+, carrier(other.carrier)
 {}
 
 Marker::Marker(Marker && other)
@@ -687,6 +1231,7 @@ Marker::Marker(Marker && other)
 , stat(std::move(other.stat))
 , gmap(std::move(other.gmap))
 , data(std::move(other.data))
+, carrier(std::move(other.carrier))
 {}
 
 Marker & Marker::operator = (const Marker & other)
@@ -697,6 +1242,7 @@ Marker & Marker::operator = (const Marker & other)
 		this->stat = other.stat;
 		this->gmap = other.gmap;
 		this->data = other.data;
+		this->carrier = other.carrier;
 	}
 	return *this;
 }
@@ -709,6 +1255,7 @@ Marker & Marker::operator = (Marker && other)
 		this->stat = std::move(other.stat);
 		this->gmap = std::move(other.gmap);
 		this->data = std::move(other.data);
+		this->carrier = std::move(other.carrier);
 	}
 	return *this;
 }
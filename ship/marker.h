@@ -17,15 +17,20 @@
 #include <sstream>
 #include <iomanip>
 #include <utility>
+#include <algorithm>
 #include <stdexcept>
 
 #include "types.hpp"
 #include "census.h"
 #include "allele.h"
+#include "stream.h"
 
 
 #define DEBUG_MARKER
 
+#define MARKER_STAT_VALUES 256 // number of raw genotype values, h0 << 4 | h1
+#define MARKER_STAT_INLINE 20  // counts stored inline, i.e. up to 5 alleles and their 15 genotypes
+
 
 //******************************************************************************
 // Marker containers
@@ -39,9 +44,14 @@ class MarkerData
 private:
 	
 	std::vector<Datatype> data; // genotype array
+	std::vector<uint64_t> plane0; // bit-plane of 1st haplotypes (packed)
+	std::vector<uint64_t> plane1; // bit-plane of 2nd haplotypes (packed)
+	std::vector<uint32_t> other_index; // index of genotypes not fitting bit-planes (packed), sorted
+	std::vector<Datatype> other_value; // genotypes not fitting bit-planes (packed)
 	size_t n; // full size
 	size_t i; // increment for appending
 	bool contains_unknown_; // flag that data contains unknown haplotypes
+	bool packed_; // flag that data is stored in bit-planes
 	
 public:
 	
@@ -54,12 +64,28 @@ public:
 	// check if any haplotype is unknown
 	bool contains_unknown() const;
 	
+	// convert completed array into bit-planes
+	bool pack();
+	
+	// check if data is stored in bit-planes
+	bool is_packed() const;
+	
+	// check if all genotypes are stored in bit-planes, i.e. only haplotypes 0 and 1
+	bool is_binary() const;
+	
+	// collect bit-planes of subsample (ascending or not) into bitsets, requires binary data
+	void gather(const uint32_t *, const size_t, uint64_t *, uint64_t *) const;
+	
+	// return bit-plane of 1st (0) or 2nd (1) haplotypes, requires packed data
+	const uint64_t * plane(const int) const;
+	
 	// return size/count
 	size_t size() const;
 	size_t count() const;
 	
-	// append genotype
-	bool append(const Genotype &);
+	// append genotype, optionally counted by raw value
+	bool append(const Genotype &, size_t * = NULL);
+	bool append(const unsigned char *, const size_t, size_t * = NULL); // raw values, h0 << 4 | h1
 	
 	// erase genotype
 	bool erase(const size_t);
@@ -74,6 +100,10 @@ public:
 	// convert to string
 	std::string str() const;
 	
+	// write/read binary snapshot
+	void save(StreamBinaryOut &) const;
+	void load(StreamBinaryIn &);
+	
 	// assign
 	MarkerData & operator = (const MarkerData &);
 	MarkerData & operator = (MarkerData &&);
@@ -134,20 +164,45 @@ class MarkerStat
 private:
 	
 	bool evaluated; // flag that stats were calculated
+	uint8_t  n_allele; // number of alleles
+	uint32_t size_; // number of genotypes (samples)
+	uint32_t unknown_haplotype_; // missing/undefined haplotypes (alleles)
+	uint32_t unknown_genotype_;  // missing/undefined genotypes
+	uint32_t inline_[ MARKER_STAT_INLINE ]; // haplotype counts followed by genotype counts
+	std::vector<uint32_t> spill_; // counts if too many alleles for inline storage
 	
-public:
+	// return counts, haplotypes followed by genotypes
+	const uint32_t * table() const;
 	
-	CensusList<Haplotype> haplotype; // expected haplotypes (alleles)
-	CensusList<Genotype>  genotype;  // expected genotypes
-	Census unknown_haplotype; // missing/undefined haplotypes (alleles)
-	Census unknown_genotype;  // missing/undefined genotypes
+	// return index of unordered genotype
+	int index(const int, const int) const;
+	
+public:
 	
 	// evaluate allele list and genotype data
 	bool evaluate(const MarkerInfo &, const MarkerData &);
 	
+	// evaluate allele list and genotype counts by raw value, given sample size
+	bool evaluate(const MarkerInfo &, const size_t *, const size_t);
+	
+	// return number of expected haplotypes (alleles) & genotypes
+	int haplotype_size() const;
+	int genotype_size() const;
+	
+	// return census of haplotype (allele) & genotype at index, scaled on demand
+	Census haplotype(const int) const;
+	Census genotype(const int) const;
+	
+	// return genotype at index, genotypes are ordered by 1st then 2nd allele
+	Genotype genotype_type(const int) const;
+	
+	// return census of missing/undefined haplotypes & genotypes
+	Census unknown_haplotype() const;
+	Census unknown_genotype() const;
+	
 	// return census statistics
-	const Census & operator [] (const Haplotype &) const;
-	const Census & operator [] (const Genotype &)  const;
+	Census operator [] (const Haplotype &) const;
+	Census operator [] (const Genotype &)  const;
 	
 	// print to stream
 	void print(std::ostream &, const char = '\0') const;
@@ -156,6 +211,10 @@ public:
 	// convert to string
 	std::string str() const;
 	
+	// write/read binary snapshot
+	void save(StreamBinaryOut &) const;
+	void load(StreamBinaryIn &);
+	
 	// constant header for printing
 	static const std::string header;
 	
@@ -170,6 +229,42 @@ public:
 };
 
 
+//
+// Marker carriers of rare haplotypes
+//
+class MarkerCarrier
+{
+private:
+	
+	std::vector<Haplotype> haplotype_; // indexed haplotypes
+	std::vector<uint32_t>  offset_;    // begin of carrier list for each haplotype in pool, one extra at end
+	std::vector<uint32_t>  sample_id_; // pooled carrier lists, sorted sample IDs
+	
+public:
+	
+	// index carriers of haplotypes with count at or below cutoff
+	void evaluate(const MarkerStat &, const MarkerData &, const Census &);
+	
+	// check if haplotype is indexed
+	bool contains(const Haplotype &) const;
+	
+	// return carriers of haplotype and set their number, NULL if not indexed
+	const uint32_t * find(const Haplotype &, size_t &) const;
+	
+	// return number of indexed haplotypes
+	int size() const;
+	
+	// assign
+	MarkerCarrier & operator = (const MarkerCarrier &);
+	MarkerCarrier & operator = (MarkerCarrier &&);
+	
+	// construct
+	MarkerCarrier(); // default
+	MarkerCarrier(const MarkerCarrier &); // copy
+	MarkerCarrier(MarkerCarrier &&); // move
+};
+
+
 //
 // Marker in genetic map
 //
@@ -215,6 +310,7 @@ struct Marker
 	MarkerStat stat;
 	MarkerGmap gmap;
 	MarkerData data;
+	MarkerCarrier carrier;
 	
 	// compare/sort
 	bool operator <  (const Marker & other) const;
@@ -11,12 +11,19 @@
 
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <string>
 #include <vector>
 #include <unordered_set>
 #include <utility>
 #include <thread>
+#include <stdexcept>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "stream.h"
 #include "sample.h"
@@ -24,6 +31,9 @@
 #include "genmap.h"
 
 
+//#define DEBUG_PARSE_GENOTYPES // cross-check vectorised genotype decoding with scalar parser
+
+
 //
 // token line from sample file
 //
@@ -159,9 +169,228 @@ inline bool parse_genmap_4col(char * line, GenmapInfo & info)
 
 
 //
-// token line from VCF file
+// decode run of regular genotypes from VCF line, i.e. single-digit haplotypes
+// separated by '|' or '/' and followed by a tab (GT-only layout), into raw
+// genotype values; stops at the first irregular field or at the end of line,
+// returns number of decoded genotypes
+//
+inline size_t parse_vcf_genotypes(const char * ptr, const char * end, unsigned char * out, const size_t max)
+{
+	size_t n = 0;
+	
+#if defined(__SSE2__)
+	// 4 genotypes per 16 bytes, laid out in 32-bit lanes as [h0, sep, h1, tab]
+	const __m128i zero  = _mm_set1_epi8('0');
+	const __m128i nine  = _mm_set1_epi8(9);
+	const __m128i digit = _mm_set1_epi32(0x00FF00FF); // haplotype bytes
+	const __m128i phase = _mm_set1_epi32(0x09007C00); // '|' & tab
+	const __m128i unph  = _mm_set1_epi32(0x09002F00); // '/' & tab
+	const __m128i low   = _mm_set1_epi32(0x0F);
+	
+	// check layout & decode 4 genotypes into 32-bit lanes
+	auto decode = [&](const char * p, __m128i & g) -> bool
+	{
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+		const __m128i x = _mm_sub_epi8(v, zero);
+		
+		const __m128i is_digit = _mm_cmpeq_epi8(_mm_min_epu8(x, nine), x);
+		const __m128i is_sep   = _mm_or_si128(_mm_cmpeq_epi8(v, phase), _mm_cmpeq_epi8(v, unph));
+		const __m128i is_valid = _mm_or_si128(_mm_and_si128(digit, is_digit), _mm_andnot_si128(digit, is_sep));
+		
+		g = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(x, low), 4), _mm_and_si128(_mm_srli_epi32(x, 16), low));
+		
+		return (_mm_movemask_epi8(is_valid) == 0xFFFF);
+	};
+	
+	__m128i g0, g1, g2, g3;
+	
+	// 16 genotypes per iteration
+	while (n + 16 <= max && end - ptr >= 64 &&
+		   decode(ptr, g0) && decode(ptr + 16, g1) && decode(ptr + 32, g2) && decode(ptr + 48, g3))
+	{
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(out + n), _mm_packus_epi16(_mm_packs_epi32(g0, g1), _mm_packs_epi32(g2, g3)));
+		
+		ptr += 64;
+		n += 16;
+	}
+	
+	// 4 genotypes per iteration
+	while (n + 4 <= max && end - ptr >= 16 && decode(ptr, g0))
+	{
+		const int32_t raw = _mm_cvtsi128_si32(_mm_packus_epi16(_mm_packs_epi32(g0, g0), g0));
+		memcpy(out + n, &raw, 4);
+		
+		ptr += 16;
+		n += 4;
+	}
+#endif
+	
+	// single genotypes
+	while (n < max && end - ptr >= 4 &&
+		   (unsigned char)(ptr[0] - '0') < 10 &&
+		   (ptr[1] == '|' || ptr[1] == '/') &&
+		   (unsigned char)(ptr[2] - '0') < 10 &&
+		   ptr[3] == '\t')
+	{
+		out[n++] = (unsigned char)((ptr[0] - '0') << 4 | (ptr[2] - '0'));
+		ptr += 4;
+	}
+	
+	return n;
+}
+
+
+//
+// read allele counts from INFO column of untokenised VCF line, i.e. AN and AC
+// (or AF) for each alternative allele; count holds reference allele first,
+// returns false if counts are missing, inconsistent or exceed the haplotypes
+// of the given sample size (e.g. stale counts of a sample subset)
 //
-inline bool parse_vcf_line(char * line, MarkerInfo & info, MarkerData & data, std::string & comment)
+inline bool parse_vcf_info_count(const char * line, std::vector<size_t> & count, const size_t size)
+{
+	const char * alt  = NULL; // begin of ALT column
+	const char * info = NULL; // begin of INFO column
+	const char * end  = line; // end of INFO column
+	
+	for (int col = 1; col <= 8; ++col)
+	{
+		if (col == 5) alt  = end;
+		if (col == 8) info = end;
+		
+		end = strchr(end, '\t');
+		
+		if (end == NULL)
+		{
+			return false;
+		}
+		
+		if (col < 8)
+		{
+			++end;
+		}
+	}
+	
+	// count alternative alleles
+	if (alt[0] == '.' && alt[1] == '\t')
+	{
+		return false;
+	}
+	
+	size_t n_alt = 1;
+	
+	for (const char * p = alt; *p != '\t'; ++p)
+	{
+		if (*p == ',') ++n_alt;
+	}
+	
+	// read unsigned number, advance pointer
+	auto number = [] (const char * & p, size_t & n) -> bool
+	{
+		if (*p < '0' || *p > '9')
+			return false;
+		
+		for (n = 0; *p >= '0' && *p <= '9'; ++p)
+		{
+			n = n * 10 + static_cast<size_t>(*p - '0');
+		}
+		
+		return true;
+	};
+	
+	thread_local std::vector<double> freq;
+	
+	size_t an = 0;
+	bool has_an = false, has_ac = false, has_af = false;
+	
+	count.assign(n_alt + 1, 0);
+	freq.assign(n_alt, 0);
+	
+	// walkabout keys
+	for (const char * p = info; p < end; )
+	{
+		if (end - p > 3 && p[2] == '=' && p[0] == 'A')
+		{
+			const char * q = p + 3;
+			
+			// total number of alleles
+			if (p[1] == 'N')
+			{
+				has_an = number(q, an) && (*q == ';' || q == end);
+			}
+			
+			// allele count per alternative allele
+			if (p[1] == 'C')
+			{
+				has_ac = true;
+				
+				for (size_t i = 1; i <= n_alt && has_ac; ++i)
+				{
+					has_ac = number(q, count[i]) && (*q == ((i < n_alt) ? ',': ';') || (i == n_alt && q == end));
+					++q;
+				}
+			}
+			
+			// allele frequency per alternative allele
+			if (p[1] == 'F')
+			{
+				has_af = true;
+				
+				for (size_t i = 0; i < n_alt && has_af; ++i)
+				{
+					char * r;
+					freq[i] = strtod(q, &r);
+					
+					has_af = (r != q) && (*r == ((i + 1 < n_alt) ? ',': ';') || (i + 1 == n_alt && r == end));
+					q = r + 1;
+				}
+			}
+		}
+		
+		// next key
+		while (p < end && *p != ';') ++p;
+		++p;
+	}
+	
+	if (! has_an || (! has_ac && ! has_af) || an > size * 2) // two haplotypes per genotype
+	{
+		return false;
+	}
+	
+	// approximate counts from frequencies
+	if (! has_ac)
+	{
+		for (size_t i = 0; i < n_alt; ++i)
+		{
+			count[i + 1] = static_cast<size_t>(round(freq[i] * static_cast<double>(an)));
+		}
+	}
+	
+	// reference allele count
+	size_t sum = 0;
+	
+	for (size_t i = 1; i <= n_alt; ++i)
+	{
+		sum += count[i];
+	}
+	
+	if (sum > an)
+	{
+		return false;
+	}
+	
+	count[0] = an - sum;
+	
+	return true;
+}
+
+
+//
+// token line from VCF file; optional column mask holds for each sample column
+// the number of consecutive kept columns starting there, or 0 if the column is
+// excluded (excluded columns are not decoded); optional count table collects
+// decoded genotypes by raw value (MARKER_STAT_VALUES entries)
+//
+inline bool parse_vcf_line(char * line, MarkerInfo & info, MarkerData & data, std::string & comment, const std::vector<size_t> * mask = NULL, size_t * count = NULL)
 {
 	std::unordered_set<std::string> unique; // check allele strings
 	
@@ -276,9 +505,29 @@ inline bool parse_vcf_line(char * line, MarkerInfo & info, MarkerData & data, st
 				Genotype g;
 				flag = true;
 				
+				thread_local std::vector<unsigned char> raw;
+				const char * end = (token.remain() != NULL) ? token.remain() + strlen(token.remain()): NULL; // end of line
+				
 				// continue with data
 				do
 				{
+					// skip excluded columns
+					if (mask != NULL)
+					{
+						const size_t c = token.count() - 10; // sample column
+						
+						if (c >= mask->size())
+						{
+							comment = "More genotypes than expected: exceeds " + std::to_string(mask->size());
+							return false;
+						}
+						
+						if ((*mask)[c] == 0)
+						{
+							continue;
+						}
+					}
+					
 					if (token.size() < 3)
 					{
 						comment = "Invalid genotype in column " + std::to_string(token.count());
@@ -312,14 +561,45 @@ inline bool parse_vcf_line(char * line, MarkerInfo & info, MarkerData & data, st
 						g.h1 = conv;
 					}
 					
-					if (! data.append(g))
+					if (! data.append(g, count))
 					{
 						comment = "More genotypes than expected: exceeds " + std::to_string(data.size());
 						return false;
 					}
+					
+					// decode following run of regular genotypes at once
+					if (token.remain() != NULL)
+					{
+						raw.resize(data.size());
+						
+						const size_t max = (mask != NULL) ? std::min(data.size() - data.count(), (*mask)[token.count() - 10] - 1): data.size() - data.count(); // stop before next excluded column
+						const size_t n = parse_vcf_genotypes(token.remain(), end, &raw[0], max);
+						
+#ifdef DEBUG_PARSE_GENOTYPES
+						for (size_t k = 0; k < n; ++k)
+						{
+							const char * p = token.remain() + 4 * k;
+							
+							if (static_cast<Genotype>(Datatype(raw[k])) != Genotype(p[0] - '0', p[2] - '0'))
+								throw std::logic_error("Vectorised genotype decoding differs from scalar parser");
+						}
+#endif
+						
+						if (n > 0)
+						{
+							data.append(&raw[0], n, count);
+							token.forward(token.remain() + 4 * n, n);
+						}
+					}
 				}
 				while (token.next());
 				
+				if (mask != NULL && token.count() - 9 != mask->size())
+				{
+					comment = "Less genotypes than expected: " + std::to_string(token.count() - 9) + " found, " + std::to_string(mask->size()) + " expected";
+					return false;
+				}
+				
 				if (! data.is_complete())
 				{
 					comment = "Less genotypes than expected: " + std::to_string(data.count()) + " found, " + std::to_string(data.size()) + " expected";
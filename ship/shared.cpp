@@ -9,6 +9,26 @@
 #include "shared.h"
 
 
+#define SHARED_ARENA_NODES   65536 // nodes per block of scan memory
+#define SHARED_ARENA_SAMPLES 1048576 // samples per block of scan memory
+#define SHARED_TREE_MAGIC    0x3145525450494853ULL // "SHIPTRE1"
+#define SHARED_TREE_VERSION  1
+#define SHARED_SCAN_BATCH    65536 // roots scanned at once, memory of nodes is released after each batch
+#define SHARED_RECORD_QUEUE  4096 // max number of root records waiting to be written
+#define SHARED_MATRIX_ENTRY 32 // approx. memory of one entry in sparse hash (bytes)
+#define SHARED_SHARE_BLOCK 256 // roots claimed at once when detecting subsamples
+#define SHARED_BITSET_BLOCK 4096 // roots counted at once in all-pairs mode
+#define SHARED_BINARY_MAGIC "SHIPSHR\0" // 8 bytes identifying binary sharing matrix
+#define SHARED_BINARY_VERSION 1 // layout of binary sharing matrix
+
+// bitset kernel in all-pairs mode only with hardware popcount (e.g. -mpopcnt),
+// cost of adding one carrier pair relative to intersecting one word of bitsets,
+// measured 10 to 44 (1.6 to 9 without hardware popcount), see test/share_kernel.cpp
+#if defined(__POPCNT__)
+#define SHARED_BITSET_COST 10
+#endif
+
+
 
 //******************************************************************************
 // Shared haplotype containers
@@ -25,30 +45,160 @@ SharedType::SharedType(const Haplotype _haplotype, const size_t _marker_id)
 
 
 //
-// Shared haplotype tree structure
+// Shared haplotype trees, flat storage
+//
+
+size_t SharedTree::size() const
+{
+	return this->end_.size();
+}
+
+Haplotype SharedTree::haplotype(const size_t i) const
+{
+	return Haplotype(this->haplotype_[i]);
+}
+
+bool SharedTree::side(const size_t i) const
+{
+	return (this->side_[i] != 0);
+}
+
+size_t SharedTree::marker_id(const size_t i) const
+{
+	return this->marker_[i];
+}
+
+size_t SharedTree::stop(const size_t i) const
+{
+	return this->stop_[i];
+}
+
+uint64_t SharedTree::parent(const size_t i) const
+{
+	return this->parent_[i];
+}
+
+size_t SharedTree::end(const size_t i) const
+{
+	return this->end_[i];
+}
+
+const uint32_t * SharedTree::sample(const size_t i) const
+{
+	return this->sample_.data() + this->offset_[i];
+}
+
+size_t SharedTree::sample_size(const size_t i) const
+{
+	return this->offset_[i + 1] - this->offset_[i];
+}
+
+size_t SharedTree::count(const size_t i) const
+{
+	return this->end_[i] - i - 1;
+}
+
+size_t SharedTree::append(const Haplotype haplotype, const bool side, const size_t marker_id, const size_t stop, const uint64_t parent, const uint32_t * sample, const size_t n_sample)
+{
+#ifdef DEBUG_SHARED
+	if (marker_id > UINT32_MAX || stop > UINT32_MAX)
+	{
+		throw std::out_of_range("Marker ID exceeds tree storage");
+	}
+#endif
+	
+	const size_t i = this->end_.size();
+	
+	if (this->offset_.empty())
+		this->offset_.push_back(0);
+	
+	this->haplotype_.push_back(static_cast<unsigned char>((int)haplotype));
+	this->side_.push_back((side) ? 1: 0);
+	this->marker_.push_back(static_cast<uint32_t>(marker_id));
+	this->stop_.push_back(static_cast<uint32_t>(stop));
+	this->parent_.push_back(parent);
+	this->end_.push_back(i + 1); // set when sub-tree is complete
+	this->sample_.insert(this->sample_.end(), sample, sample + n_sample);
+	this->offset_.push_back(this->sample_.size());
+	
+	return i;
+}
+
+void SharedTree::close(const size_t i)
+{
+	this->end_[i] = this->end_.size();
+}
+
+void SharedTree::save(StreamBinaryOut & out) const
+{
+	out.put(this->haplotype_);
+	out.put(this->side_);
+	out.put(this->marker_);
+	out.put(this->stop_);
+	out.put(this->parent_);
+	out.put(this->end_);
+	out.put(this->offset_);
+	out.put(this->sample_);
+}
+
+
+//
+// Memory of tree scans on one thread
 //
 
-SharedTree::SharedTree(const bool _side)
-: side(_side)
+SharedArena::SharedArena()
+: node(SHARED_ARENA_NODES)
+, sample(SHARED_ARENA_SAMPLES)
 {}
 
-void SharedTree::scan(const Source & source, const SharedType & type)
+void SharedArena::expand(const Source & source, SharedNode & node)
 {
 	static const int hmax = Haplotype::unknown + 1;
 	const size_t n_marker = source.marker_size(); // right hand side bound
-	const size_t n_sample = type.sample_id.size(); // number of subsamples
+	const size_t n_sample = node.n_sample; // number of subsamples
 	
-	this->stop = type.marker_id;
+	node.stop    = node.marker_id;
+	node.child   = nullptr;
+	node.n_child = 0;
 	
 	if (n_sample < 2)
 		return;
 	
-	size_t marker_id = type.marker_id; // current marker ID
+	const size_t   n_word = (n_sample + 63) / 64; // words of subsample bitsets
+	const uint64_t last   = ((n_sample & 63) == 0) ? ~uint64_t(0): (uint64_t(1) << (n_sample & 63)) - 1; // valid bits of last word
+	
+	this->g0.resize(n_sample);
+	this->g1.resize(n_sample);
+	this->b0.resize(n_word);
+	this->b1.resize(n_word);
+	
+	int * G0 = &this->g0[0];
+	int * G1 = &this->g1[0];
+	uint64_t * B0 = &this->b0[0];
+	uint64_t * B1 = &this->b1[0];
+	
+	const SourceTable & table = source.table();
+	
+	// sample-major tiles, words of subsample are reused for 64 markers
+	const SourceTile & tile = source.tile();
+	const bool tiled = ! tile.empty();
+	size_t cached = SIZE_MAX; // marker word held in W0/W1
+	
+	if (tiled)
+	{
+		this->w0.resize(n_sample);
+		this->w1.resize(n_sample);
+	}
+	
+	uint64_t * W0 = (tiled) ? &this->w0[0]: nullptr;
+	uint64_t * W1 = (tiled) ? &this->w1[0]: nullptr;
+	
+	size_t marker_id = node.marker_id; // current marker ID
 	
 	// walkabout
 	while (true)
 	{
-		if (this->side) // right scan
+		if (node.side) // right scan
 		{
 			++marker_id;
 			
@@ -63,30 +213,122 @@ void SharedTree::scan(const Source & source, const SharedType & type)
 			--marker_id;
 		}
 		
-		bool flag = true; // flag that all are heterozygous
+		const MarkerData * data = &table.data(marker_id);
 		
-		const Marker * mptr = &source.marker(marker_id);
+		// biallelic data, word operations on bitsets of subsample
+		if (table.is_binary(marker_id))
+		{
+			if (tiled)
+			{
+				// load 64 markers of each subsample at once
+				if (marker_id / 64 != cached)
+				{
+					cached = marker_id / 64;
+					
+					for (size_t i = 0; i < n_sample; ++i)
+					{
+						W0[i] = tile.word0(node.sample[i], marker_id);
+						W1[i] = tile.word1(node.sample[i], marker_id);
+					}
+				}
+				
+				const int shift = marker_id % 64;
+				
+				for (size_t w = 0, i = 0; i < n_sample; ++w)
+				{
+					uint64_t x0 = 0, x1 = 0;
+					
+					for (size_t k = 0; k < 64 && i < n_sample; ++k, ++i)
+					{
+						x0 |= ((W0[i] >> shift) & 1) << k;
+						x1 |= ((W1[i] >> shift) & 1) << k;
+					}
+					
+					B0[w] = x0;
+					B1[w] = x1;
+				}
+			}
+			else
+			{
+				data->gather(node.sample, n_sample, B0, B1);
+			}
+			
+			size_t n_het = 0; // number of heterozygous
+			size_t n_one = 0; // number carrying 1
+			size_t n_nil = 0; // number carrying 0
+			
+			for (size_t w = 0; w < n_word; ++w)
+			{
+				n_het += __builtin_popcountll(B0[w] ^ B1[w]);
+				n_one += __builtin_popcountll(B0[w] | B1[w]);
+				n_nil += __builtin_popcountll(~(B0[w] & B1[w]) & ((w + 1 == n_word) ? last: ~uint64_t(0)));
+			}
+			
+			const int n_haplotypes = (n_nil != 0) + (n_one != 0);
+			
+			if ( n_haplotypes == 1 ||                 // all homozygous
+				(n_haplotypes == 2 && n_het == n_sample) || // all heterozygous with same two haplotypes
+				 n_nil == n_sample || n_one == n_sample)    // haplotype is shared by all
+			{
+				node.stop = marker_id;
+				continue; // no breakpoint
+			}
+			
+			// breakpoint
+			const size_t n_child = (n_nil > 2) + (n_one > 2);
+			
+			if (n_child == 0)
+				break;
+			
+			node.child   = this->node.alloc(n_child);
+			node.n_child = n_child;
+			
+			SharedNode * child = node.child;
+			
+			for (int h = 0; h < 2; ++h)
+			{
+				const size_t n_carrier = (h == 0) ? n_nil: n_one;
+				
+				if (n_carrier <= 2)
+					continue;
+				
+				uint32_t * sample = this->branch(*child++, node, Haplotype(h), marker_id, n_carrier); // new sub node
+				
+				// insert subsample, in sample order
+				for (size_t w = 0; w < n_word; ++w)
+				{
+					uint64_t bits = (h == 0) ? ~(B0[w] & B1[w]) & ((w + 1 == n_word) ? last: ~uint64_t(0)): (B0[w] | B1[w]);
+					
+					while (bits != 0)
+					{
+						*sample++ = node.sample[ w * 64 + __builtin_ctzll(bits) ];
+						bits &= bits - 1;
+					}
+				}
+			}
+			
+			break;
+		}
 		
-		int G0[ n_sample ];
-		int G1[ n_sample ];
+		bool flag = true; // flag that all are heterozygous
 		
-		bool H[ hmax ] = { false };
+		size_t H[ hmax ] = { 0 }; // number of subsamples carrying haplotype
 		
 		// collect genotypes & haplotypes
 		for (size_t i = 0; i < n_sample; ++i)
 		{
-			const Genotype g = mptr->data[ type.sample_id[i] ];
+			const Genotype g = (*data)[ node.sample[i] ];
 			const int x0 = (int)g.h0;
 			const int x1 = (int)g.h1;
 			
 			G0[i] = x0;
 			G1[i] = x1;
 			
-			H[x0] = true;
+			++H[x0];
 			
 			if (g.h0 != g.h1)
 			{
-				H[x1] = true;
+				++H[x1];
 			}
 			else
 			{
@@ -98,14 +340,14 @@ void SharedTree::scan(const Source & source, const SharedType & type)
 		
 		for (int i = 0; i < hmax; ++i)
 		{
-			if (H[i])
+			if (H[i] != 0)
 				++n_haplotypes;
 		}
 		
 		if ( n_haplotypes == 1 ||        // all homozygous
 			(n_haplotypes == 2 && flag)) // all heterozygous with same two haplotypes
 		{
-			this->stop = marker_id;
+			node.stop = marker_id;
 			continue; // no breakpoint
 		}
 		else // check each haplotype to be shared by all
@@ -114,18 +356,7 @@ void SharedTree::scan(const Source & source, const SharedType & type)
 			
 			for (int h = 0; h < hmax; ++h)
 			{
-				if (!H[h])
-					continue;
-				
-				int n_shared = 0;
-				
-				for (size_t i = 0; i < n_sample; ++i)
-				{
-					if (G0[i] == h || G1[i] == h)
-						++n_shared;
-				}
-				
-				if (n_shared == n_sample)
+				if (H[h] == n_sample)
 				{
 					flag = true;
 					break;
@@ -134,44 +365,56 @@ void SharedTree::scan(const Source & source, const SharedType & type)
 			
 			if (flag) // haplotype is shared by all
 			{
-				this->stop = marker_id;
+				node.stop = marker_id;
 				continue; // no breakpoint
 			}
 			else // breakpoint
 			{
-				this->node.reserve(n_haplotypes);
+				size_t offset[ hmax + 1 ];
+				size_t fill[ hmax ];
 				
+				// group subsample by haplotype, in sample order
+				offset[0] = 0;
 				for (int h = 0; h < hmax; ++h)
 				{
-					if (!H[h])
-						continue;
-
-					std::vector<size_t> subsample_id;
-					int n_subsample = 0;
-					
-					for (size_t i = 0; i < n_sample; ++i)
-					{
-						if (G0[i] == h || G1[i] == h)
-						{
-							subsample_id.push_back(type.sample_id[i]);
-							++n_subsample;
-						}
-					}
+					offset[h + 1] = offset[h] + H[h];
+					fill[h] = offset[h];
+				}
+				
+				this->bucket.resize(offset[hmax]);
+				
+				for (size_t i = 0; i < n_sample; ++i)
+				{
+					this->bucket[ fill[ G0[i] ]++ ] = node.sample[i];
 					
-					if (n_subsample > 2)
-					{
-						SharedNode node(Haplotype(h), marker_id, this->side); // new sub node
-						
-						node.type.sample_id = std::move(subsample_id); // insert subsample
-
-						this->node.push_back(std::move(node)); // insert node
-					}
+					if (G1[i] != G0[i])
+						this->bucket[ fill[ G1[i] ]++ ] = node.sample[i];
 				}
 				
-				// scan trees for each node
-				for (std::vector<SharedNode>::iterator it = this->node.begin(), end = this->node.end(); it != end; ++it)
+				size_t n_child = 0;
+				
+				for (int h = 0; h < hmax; ++h)
+				{
+					if (H[h] > 2)
+						++n_child;
+				}
+				
+				if (n_child == 0)
+					break;
+				
+				node.child   = this->node.alloc(n_child);
+				node.n_child = n_child;
+				
+				SharedNode * child = node.child;
+				
+				for (int h = 0; h < hmax; ++h)
 				{
-					it->tree.scan(source, it->type);
+					if (H[h] > 2)
+					{
+						uint32_t * sample = this->branch(*child++, node, Haplotype(h), marker_id, H[h]); // new sub node
+						
+						std::copy(this->bucket.begin() + offset[h], this->bucket.begin() + offset[h + 1], sample); // insert subsample
+					}
 				}
 				
 				break;
@@ -180,63 +423,58 @@ void SharedTree::scan(const Source & source, const SharedType & type)
 	}
 }
 
-size_t SharedTree::count() const
+uint32_t * SharedArena::branch(SharedNode & child, const SharedNode & node, const Haplotype haplotype, const size_t marker_id, const size_t n_sample)
 {
-	size_t sum, n = this->node.size();
-	
-	sum = n;
+	child.haplotype = haplotype;
+	child.side      = node.side;
+	child.marker_id = marker_id;
+	child.stop      = marker_id;
+	child.n_sample  = n_sample;
+	child.child     = nullptr;
+	child.n_child   = 0;
 	
-	for (int i = 0; i < n; ++i)
-	{
-		sum += this->node[i].tree.count();
-	}
+	uint32_t * sample = this->sample.alloc(n_sample);
+	child.sample = sample;
 	
-	return sum;
+	return sample;
 }
 
 
-//
-// Shared haplotype node in tree
-//
-
-SharedNode::SharedNode(const Haplotype _haplotype, const size_t _marker_id, const bool _side)
-: type(_haplotype, _marker_id)
-, tree(_side)
-{}
-
-
 //
 // Shared haplotype root of tree
 //
 
 SharedRoot::SharedRoot(const Haplotype _haplotype, const size_t _marker_id)
 : type(_haplotype, _marker_id)
-, ltree(false)
-, rtree(true)
+, ltree(SharedTree::none)
+, rtree(SharedTree::none)
 {}
 
 void SharedRoot::subsample(const Source & source)
 {
-	const Marker * mptr = &source.marker(this->type.marker_id);
+	const SourceMarker marker = source.marker(this->type.marker_id);
+	
+	// look up carrier index
+	size_t n_carrier = 0;
+	const uint32_t * carrier = marker.carrier().find(this->type.haplotype, n_carrier);
+	
+	if (carrier != NULL)
+	{
+		this->type.sample_id.assign(carrier, carrier + n_carrier);
+		return;
+	}
 	
 	for (size_t sample_id = 0, n = source.sample_size(); sample_id < n; ++sample_id)
 	{
-		const Genotype g = mptr->data[sample_id];
+		const Genotype g = marker.data()[sample_id];
 		
 		if (g.h0 == this->type.haplotype || g.h1 == this->type.haplotype)
 		{
-			this->type.sample_id.push_back(sample_id);
+			this->type.sample_id.push_back(static_cast<uint32_t>(sample_id));
 		}
 	}
 }
 
-void SharedRoot::scan(const Source & source)
-{
-	this->ltree.scan(source, this->type);
-	this->rtree.scan(source, this->type);
-}
-
-
 //
 // All shared haplotypes
 //
@@ -245,17 +483,20 @@ Shared::Shared(const Source & source, const Census & cutoff)
 : size_(0)
 , marker_count_(0)
 {
-	for (size_t i = 0; i < source.marker_size(); ++i)
+	const SourceTable & table = source.table();
+	
+	for (size_t i = 0; i < table.size(); ++i)
 	{
-		const Marker * mptr = &source.marker(i);
 		bool flag = false;
 		
-		for (int k = 0; k < mptr->stat.haplotype.size(); ++k)
+		for (int k = 0; k < table.allele_size(i); ++k)
 		{
-			if (mptr->stat.haplotype.census(k) >  size_t(1) && // exclude singletons
-				mptr->stat.haplotype.census(k) <= cutoff) // below/equal specified threshold
+			const size_t count = table.allele_count(i, k);
+			
+			if (count >  1 && // exclude singletons
+				cutoff >= count) // below/equal specified threshold
 			{
-				this->root.push_back(SharedRoot(mptr->stat.haplotype.type(k), i));
+				this->root.push_back(SharedRoot(Haplotype(k), i));
 				++this->size_;
 				flag = true;
 			}
@@ -300,50 +541,1239 @@ size_t Shared::marker_count() const
 	return this->marker_count_;
 }
 
-void Shared::scan_parallel(const std::vector<size_t> & index, const Source & source, ProgressBar & progress)
+void Shared::share(const Source & source, SharedMatrix & matrix, const int threads, const bool all)
 {
-	for (size_t i : index)
+	ProgressBar progress(this->size_ + ((all) ? this->size_: matrix.shards()));
+	ProgressCounter counter(progress);
+	
+	// detect subsamples, roots are claimed in blocks
 	{
-		this->ex_scan.lock();
-		progress.update();
-		this->ex_scan.unlock();
+		std::atomic<size_t> next(0);
+		
+		auto work = [this, &source, &counter, &next]()
+		{
+			for (size_t i = next.fetch_add(SHARED_SHARE_BLOCK); i < this->size_; i = next.fetch_add(SHARED_SHARE_BLOCK))
+			{
+				const size_t end = std::min(i + SHARED_SHARE_BLOCK, this->size_);
+				
+				for (size_t k = i; k < end; ++k)
+				{
+					this->root[k].subsample(source);
+				}
+				
+				counter.update(end - i);
+			}
+		};
+		
+		std::vector<std::thread> t;
+		
+		for (int k = 1; k < threads; ++k)
+		{
+			t.push_back(std::thread(work));
+		}
+		
+		work(); // on this thread
 		
-		this->root[i].scan(source);
+		for (std::thread & _t : t)
+		{
+			_t.join();
+		}
+	}
+	
+	size_t n_bitset = 0;
+	const size_t n_block = (this->size_ + SHARED_BITSET_BLOCK - 1) / SHARED_BITSET_BLOCK;
+	
+	// count pairs
+	if (all)
+	{
+		n_bitset = this->share_all(matrix, counter, threads);
+	}
+	else
+	{
+		this->share_adjacent(matrix, counter, threads);
+	}
+	
+	counter.finish();
+	progress.finish();
+	
+	if (all)
+	{
+		std::clog << "Counted all pairs of carriers in " << n_block << " blocks of roots (" << n_bitset << " by bitset intersection)" << std::endl;
 	}
 }
 
-void Shared::scan(const Source & source, const int threads)
+void Shared::share_adjacent(SharedMatrix & matrix, ProgressCounter & counter, const int threads) const
 {
-	ProgressBar progress(this->size_);
+	const size_t n_shard = matrix.shards();
+	std::vector<size_t> lo(n_shard); // first row of each shard
+	std::vector< std::vector<size_t> > bucket(n_shard); // roots with first carrier of any adjacent pair in shard
 	
-	std::vector<std::thread> t;
-	std::vector< std::vector<size_t> > index(threads);
+	for (size_t s = 0; s < n_shard; ++s)
+	{
+		lo[s] = matrix.rows(s).first;
+	}
 	
-	int k = 0;
+	// partition roots once, from shard of first to shard of second last carrier
 	for (size_t i = 0; i < this->size_; ++i)
 	{
-		index[k++].push_back(i);
+		const std::vector<uint32_t> & sample_id = this->root[i].type.sample_id; // ascending
+		const size_t nsub = sample_id.size();
+		
+		if (nsub < 2) // exclude doubletons in same individual
+			continue;
 		
-		if (k == threads)
-			k = 0;
+		const size_t s0 = std::upper_bound(lo.begin(), lo.end(), sample_id.front())   - lo.begin() - 1;
+		const size_t s1 = std::upper_bound(lo.begin(), lo.end(), sample_id[nsub - 2]) - lo.begin() - 1;
+		
+		for (size_t s = s0; s <= s1; ++s)
+		{
+			bucket[s].push_back(i);
+		}
 	}
 	
-	for (k = 1; k < threads; ++k)
+	std::atomic<size_t> next(0);
+	
+	// each shard of rows is filled by one thread
+	auto work = [this, &matrix, &counter, &next, &bucket]()
+	{
+		for (size_t s = next++; s < matrix.shards(); s = next++)
+		{
+			const std::pair<size_t, size_t> rows = matrix.rows(s);
+			
+			for (const size_t i : bucket[s])
+			{
+				const std::vector<uint32_t> & sample_id = this->root[i].type.sample_id; // ascending
+				const size_t nsub = sample_id.size();
+				
+				// pairs of adjacent carriers with first carrier in shard
+				size_t k0 = std::lower_bound(sample_id.begin(), sample_id.end(), rows.first) - sample_id.begin();
+				
+				for (size_t k1 = k0 + 1; k1 < nsub && sample_id[k0] < rows.second; ++k0, ++k1)
+				{
+					matrix.add(sample_id[k0], sample_id[k1]);
+				}
+			}
+			
+			std::vector<size_t>().swap(bucket[s]); // release memory
+			
+			counter.update();
+		}
+	};
+	
+	std::vector<std::thread> t;
+	
+	for (int k = 1; k < threads; ++k)
 	{
-		t.push_back(std::thread(&Shared::scan_parallel, this, std::ref(index[k]), std::ref(source), std::ref(progress)));
+		t.push_back(std::thread(work));
 	}
 	
-	this->scan_parallel(index[0], source, progress); // run on this thread
+	work(); // on this thread
 	
 	for (std::thread & _t : t)
 	{
 		_t.join();
 	}
-	
-	progress.finish();
 }
 
-
-
-
-
+size_t Shared::share_all(SharedMatrix & matrix, ProgressCounter & counter, const int threads) const
+{
+	std::vector<size_t> index(matrix.size(), 0); // position of sample in active + 1, reset after each block
+	std::vector<size_t> active; // samples carrying any root in block, ascending
+	std::vector<uint64_t> bits; // roots carried by each active sample
+	
+	size_t begin = 0, end = 0; // roots of current block
+	size_t n_word = 0; // words per sample
+	bool   bitset = false; // flag that block is counted by bitset intersection
+	
+	// count pairs with first sample in shard of rows
+	auto count = [this, &matrix, &active, &bits, &begin, &end, &n_word, &bitset](const size_t s)
+	{
+		const std::pair<size_t, size_t> rows = matrix.rows(s);
+		const size_t n_active = active.size();
+		
+		if (bitset)
+		{
+			// active samples in shard
+			const size_t a0 = std::lower_bound(active.begin(), active.end(), rows.first)  - active.begin();
+			const size_t a1 = std::lower_bound(active.begin(), active.end(), rows.second) - active.begin();
+			
+			for (size_t a = a0; a < a1; ++a)
+			{
+				const uint64_t * x = &bits[a * n_word];
+				
+				for (size_t b = a + 1; b < n_active; ++b)
+				{
+					const uint64_t * y = &bits[b * n_word];
+					uint32_t n = 0;
+					
+					for (size_t w = 0; w < n_word; ++w)
+					{
+						n += __builtin_popcountll(x[w] & y[w]);
+					}
+					
+					if (n != 0)
+						matrix.add(active[a], active[b], n);
+				}
+			}
+		}
+		else
+		{
+			for (size_t i = begin; i < end; ++i)
+			{
+				const std::vector<uint32_t> & sample_id = this->root[i].type.sample_id; // ascending
+				const size_t nsub = sample_id.size();
+				
+				if (nsub < 2 || // exclude doubletons in same individual
+					sample_id.front() >= rows.second ||
+					sample_id.back()  <  rows.first)
+					continue;
+				
+				// all pairs of carriers with first carrier in shard, row by row
+				for (size_t k0 = std::lower_bound(sample_id.begin(), sample_id.end(), rows.first) - sample_id.begin(); k0 < nsub && sample_id[k0] < rows.second; ++k0)
+				{
+					for (size_t k1 = k0 + 1; k1 < nsub; ++k1)
+					{
+						matrix.add(sample_id[k0], sample_id[k1]);
+					}
+				}
+			}
+		}
+	};
+	
+	// threads count shards of each block, started once
+	std::atomic<size_t> next(0);
+	std::mutex ex_block;
+	std::condition_variable cv_ready, cv_done;
+	size_t generation = 0; // number of blocks handed to threads
+	int    n_done = 0; // number of threads done with current block
+	bool   stop = false; // flag that all blocks are counted
+	std::exception_ptr ex_count; // first exception of a thread
+	
+	auto shards = [&matrix, &next, &count]()
+	{
+		for (size_t s = next++; s < matrix.shards(); s = next++)
+		{
+			count(s);
+		}
+	};
+	
+	auto work = [&]()
+	{
+		size_t seen = 0;
+		
+		while (true)
+		{
+			{
+				std::unique_lock<std::mutex> lock(ex_block);
+				cv_ready.wait(lock, [&]() { return (generation != seen || stop); });
+				
+				if (generation == seen)
+					return;
+				
+				seen = generation;
+			}
+			
+			try
+			{
+				shards();
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> lock(ex_block);
+				if (! ex_count)
+					ex_count = std::current_exception();
+			}
+			
+			{
+				std::lock_guard<std::mutex> lock(ex_block);
+				if (++n_done == threads - 1)
+					cv_done.notify_one();
+			}
+		}
+	};
+	
+	std::vector<std::thread> t;
+	size_t n_bitset = 0;
+	
+	// stop & join threads, also after counting failed
+	auto join = [&]()
+	{
+		{
+			std::lock_guard<std::mutex> lock(ex_block);
+			stop = true;
+		}
+		
+		cv_ready.notify_all();
+		
+		for (std::thread & _t : t)
+		{
+			_t.join();
+		}
+	};
+	
+	try
+	{
+		for (int k = 1; k < threads; ++k)
+		{
+			t.push_back(std::thread(work));
+		}
+		
+		for (begin = 0; begin < this->size_; begin = end)
+		{
+			end = std::min(begin + SHARED_BITSET_BLOCK, this->size_);
+			n_word = (end - begin + 63) / 64;
+			
+			active.clear();
+			size_t n_pair = 0; // number of carrier pairs in block
+			
+			for (size_t i = begin; i < end; ++i)
+			{
+				const std::vector<uint32_t> & sample_id = this->root[i].type.sample_id;
+				const size_t nsub = sample_id.size();
+				
+				if (nsub < 2)
+					continue;
+				
+				n_pair += nsub * (nsub - 1) / 2;
+				
+				for (size_t k = 0; k < nsub; ++k)
+				{
+					if (index[ sample_id[k] ] == 0)
+					{
+						active.push_back(sample_id[k]);
+						index[ sample_id[k] ] = 1;
+					}
+				}
+			}
+			
+			std::sort(active.begin(), active.end());
+			
+			// choose kernel, intersect bitsets of all active pairs if cheaper than enumerating carrier pairs
+			const size_t n_active = active.size();
+			
+#if defined(SHARED_BITSET_COST)
+			bitset = (n_active > 1 && n_active * (n_active - 1) / 2 * n_word < n_pair * SHARED_BITSET_COST);
+#else
+			bitset = false;
+#endif
+			
+			if (bitset)
+			{
+				for (size_t a = 0; a < n_active; ++a)
+				{
+					index[ active[a] ] = a + 1;
+				}
+				
+				bits.assign(n_active * n_word, 0);
+				
+				for (size_t i = begin; i < end; ++i)
+				{
+					const std::vector<uint32_t> & sample_id = this->root[i].type.sample_id;
+					
+					if (sample_id.size() < 2)
+						continue;
+					
+					const size_t   w = (i - begin) / 64;
+					const uint64_t b = uint64_t(1) << ((i - begin) % 64);
+					
+					for (size_t k = 0, nsub = sample_id.size(); k < nsub; ++k)
+					{
+						bits[ (index[ sample_id[k] ] - 1) * n_word + w ] |= b;
+					}
+				}
+				
+				++n_bitset;
+			}
+			
+			// hand block to threads & count on this thread
+			next = 0;
+			
+			{
+				std::lock_guard<std::mutex> lock(ex_block);
+				n_done = 0;
+				++generation;
+			}
+			
+			cv_ready.notify_all();
+			
+			shards();
+			
+			{
+				std::unique_lock<std::mutex> lock(ex_block);
+				cv_done.wait(lock, [&]() { return (n_done == threads - 1); });
+			}
+			
+			if (ex_count)
+				std::rethrow_exception(ex_count);
+			
+			// reset index of active samples
+			for (size_t a = 0; a < n_active; ++a)
+			{
+				index[ active[a] ] = 0;
+			}
+			
+			counter.update(end - begin);
+		}
+	}
+	catch (...)
+	{
+		join();
+		throw;
+	}
+	
+	join();
+	
+	return n_bitset;
+}
+
+void Shared::scan(const Source & source, const int threads, StreamOut * out, const bool keep)
+{
+	ProgressBar progress(this->size_);
+	ProgressCounter counter(progress);
+	
+	// records of completed roots are written while scanning
+	StreamQueue<std::string> record(SHARED_RECORD_QUEUE);
+	std::thread writer;
+	std::exception_ptr ex_write;
+	
+	if (out != nullptr)
+	{
+		out->line(SharedPool::header);
+		
+		writer = std::thread([out, &record, &ex_write]()
+		{
+			std::string line;
+			
+			// keep emptying queue after error to not block scanning threads
+			while (record.pop(line))
+			{
+				if (ex_write)
+					continue;
+				
+				try
+				{
+					out->write(line);
+				}
+				catch (...)
+				{
+					ex_write = std::current_exception();
+				}
+			}
+		});
+	}
+	
+	SharedPool pool(source, counter, threads, (out != nullptr) ? &record: nullptr);
+	
+	// close queue & join writer, also after scanning failed
+	try
+	{
+		this->tree_ = SharedTree();
+		
+		// scan roots in batches, memory of nodes is released after each batch
+		for (size_t b0 = 0; b0 < this->size_; b0 += SHARED_SCAN_BATCH)
+		{
+			const size_t b1 = std::min(b0 + SHARED_SCAN_BATCH, this->size_);
+			
+			// top nodes of trees, reading subsample of root
+			SharedChunk<SharedNode> top((b1 - b0) * 2);
+			std::unique_ptr<SharedPool::Root[]> state(new SharedPool::Root[b1 - b0]);
+			
+			for (size_t i = b0; i < b1; ++i)
+			{
+				const SharedType & type = this->root[i].type;
+				SharedPool::Root & r = state[i - b0];
+				
+				r.index    = i;
+				r.root     = &this->root[i];
+				r.pending  = 2;
+				r.count[0] = 0;
+				r.count[1] = 0;
+				
+				for (int side = 0; side < 2; ++side)
+				{
+					SharedNode * node = top.alloc(1);
+					
+					node->haplotype = type.haplotype;
+					node->side      = (side == 1);
+					node->marker_id = type.marker_id;
+					node->stop      = type.marker_id;
+					node->sample    = type.sample_id.data();
+					node->n_sample  = type.sample_id.size();
+					node->child     = nullptr;
+					node->n_child   = 0;
+					
+					r.top[side] = node;
+				}
+			}
+			
+			// distribute roots, both sides of the same root on the same thread
+			int k = 0;
+			for (size_t i = b0; i < b1; ++i)
+			{
+				pool.push(k, state[i - b0].top[0], &state[i - b0], true);
+				pool.push(k, state[i - b0].top[1], &state[i - b0]);
+				
+				if (++k == threads)
+					k = 0;
+			}
+			
+			pool.run();
+			
+			// store trees in depth-first order
+			if (keep)
+			{
+				for (size_t i = b0; i < b1; ++i)
+				{
+					this->root[i].ltree = this->tree_.size();
+					this->store(state[i - b0].top[0]);
+					
+					this->root[i].rtree = this->tree_.size();
+					this->store(state[i - b0].top[1]);
+				}
+			}
+			
+			pool.clear();
+		}
+	}
+	catch (...)
+	{
+		if (out != nullptr)
+		{
+			record.close();
+			writer.join();
+		}
+		
+		throw;
+	}
+	
+	counter.finish();
+	progress.finish();
+	
+	pool.report(std::clog);
+	
+	if (out != nullptr)
+	{
+		record.close();
+		writer.join();
+		
+		if (ex_write)
+			std::rethrow_exception(ex_write);
+	}
+}
+
+void Shared::store(const SharedNode * top)
+{
+	std::vector< std::pair<const SharedNode *, size_t> > stack; // node & position of parent
+	std::vector<size_t> open; // nodes with incomplete sub-tree
+	
+	stack.push_back(std::make_pair(top, SharedTree::none));
+	
+	while (! stack.empty())
+	{
+		const SharedNode * node = stack.back().first;
+		const size_t parent = stack.back().second;
+		
+		stack.pop_back();
+		
+		// close sub-trees that do not contain this node
+		while (! open.empty() && open.back() != parent)
+		{
+			this->tree_.close(open.back());
+			open.pop_back();
+		}
+		
+		open.push_back(this->tree_.append(node->haplotype, node->side, node->marker_id, node->stop, parent, node->sample, node->n_sample));
+		
+		// children in reverse order, first child on top
+		for (size_t c = node->n_child; c > 0; --c)
+		{
+			stack.push_back(std::make_pair(node->child + (c - 1), open.back()));
+		}
+	}
+	
+	while (! open.empty())
+	{
+		this->tree_.close(open.back());
+		open.pop_back();
+	}
+}
+
+const SharedTree & Shared::tree() const
+{
+	return this->tree_;
+}
+
+void Shared::save(const std::string & filename) const
+{
+	StreamBinaryOut out(filename);
+	
+	// header
+	out.put<uint64_t>(SHARED_TREE_MAGIC);
+	out.put<uint32_t>(SHARED_TREE_VERSION);
+	
+	// roots
+	std::vector<uint32_t> marker(this->size_);
+	std::vector<unsigned char> haplotype(this->size_);
+	std::vector<uint64_t> ltree(this->size_), rtree(this->size_);
+	
+	for (size_t i = 0; i < this->size_; ++i)
+	{
+		marker[i]    = static_cast<uint32_t>(this->root[i].type.marker_id);
+		haplotype[i] = static_cast<unsigned char>((int)this->root[i].type.haplotype);
+		ltree[i]     = this->root[i].ltree;
+		rtree[i]     = this->root[i].rtree;
+	}
+	
+	out.put(marker);
+	out.put(haplotype);
+	out.put(ltree);
+	out.put(rtree);
+	
+	// trees
+	this->tree_.save(out);
+	
+	out.close();
+}
+
+
+//
+// Work-stealing scheduler for tree scans
+//
+
+SharedPool::Worker::Worker()
+: busy(0)
+, idle(0)
+, n_task(0)
+, n_steal(0)
+{}
+
+const std::string SharedPool::header = "root_id chromosome position marker_id haplotype carriers left_position right_position left_dist right_dist length_bp length_cm left_nodes right_nodes";
+
+SharedPool::SharedPool(const Source & _source, ProgressCounter & _progress, const int threads, StreamQueue<std::string> * _record)
+: source(_source)
+, progress(_progress)
+, record(_record)
+, pending(0)
+, queued(0)
+, n_idle(0)
+, failed(false)
+{
+	for (int k = 0; k < threads; ++k)
+	{
+		this->worker.push_back(std::unique_ptr<Worker>(new Worker()));
+	}
+}
+
+void SharedPool::push(const int k, SharedNode * node, Root * root, const bool first)
+{
+	Task task = { node, root, first };
+	
+	this->pending.fetch_add(1);
+	
+	{
+		std::lock_guard<std::mutex> lock(this->worker[k]->ex_task);
+		this->worker[k]->task.push_back(task);
+	}
+	
+	this->queued.fetch_add(1);
+	
+	// wake one waiting thread, lock avoids missed wake-up
+	if (this->n_idle.load() != 0)
+	{
+		{ std::lock_guard<std::mutex> lock(this->ex_idle); }
+		this->cv_idle.notify_one();
+	}
+}
+
+bool SharedPool::take(const int k, Task & task)
+{
+	const int n = static_cast<int>(this->worker.size());
+	
+	// own queue, newest first
+	{
+		Worker * w = this->worker[k].get();
+		std::lock_guard<std::mutex> lock(w->ex_task);
+		
+		if (! w->task.empty())
+		{
+			task = w->task.back();
+			w->task.pop_back();
+			this->queued.fetch_sub(1);
+			return true;
+		}
+	}
+	
+	// steal from other queues, oldest first
+	for (int i = 1; i < n; ++i)
+	{
+		Worker * w = this->worker[(k + i) % n].get();
+		std::lock_guard<std::mutex> lock(w->ex_task);
+		
+		if (! w->task.empty())
+		{
+			task = w->task.front();
+			w->task.pop_front();
+			this->queued.fetch_sub(1);
+			++this->worker[k]->n_steal;
+			return true;
+		}
+	}
+	
+	return false;
+}
+
+bool SharedPool::wait()
+{
+	std::unique_lock<std::mutex> lock(this->ex_idle);
+	
+	++this->n_idle;
+	
+	this->cv_idle.wait(lock, [this]()
+	{
+		return (this->queued.load() != 0 || this->pending.load() == 0 || this->failed.load());
+	});
+	
+	--this->n_idle;
+	
+	return (this->pending.load() != 0 && ! this->failed.load());
+}
+
+void SharedPool::wake()
+{
+	{ std::lock_guard<std::mutex> lock(this->ex_idle); }
+	this->cv_idle.notify_all();
+}
+
+void SharedPool::work(const int k)
+{
+	typedef std::chrono::steady_clock clock;
+	
+	Worker * w = this->worker[k].get();
+	Task task;
+	
+	clock::time_point t0 = clock::now(), t1;
+	
+	while (this->pending.load() != 0 && ! this->failed.load())
+	{
+		// sleep while no task is queued
+		if (! this->take(k, task))
+		{
+			if (this->queued.load() == 0 && ! this->wait())
+				break;
+			
+			continue;
+		}
+		
+		t1 = clock::now();
+		w->idle += std::chrono::duration<double>(t1 - t0).count();
+		
+		try
+		{
+			if (task.first)
+			{
+				this->progress.update();
+			}
+			
+			// expand node and queue off-going branches
+			w->arena.expand(this->source, *task.node);
+			
+			const size_t n_child = task.node->n_child;
+			
+			task.root->count[ (task.node->side) ? 1: 0 ] += n_child;
+			task.root->pending += n_child;
+			
+			for (size_t c = 0; c < n_child; ++c)
+			{
+				this->push(k, task.node->child + c, task.root);
+			}
+			
+			// root is complete after last node of both trees
+			if (task.root->pending.fetch_sub(1) == 1)
+			{
+				this->complete(*task.root);
+			}
+		}
+		catch (...)
+		{
+			// keep first exception, stop all threads
+			{
+				std::lock_guard<std::mutex> lock(this->ex_idle);
+				if (! this->ex_work)
+					this->ex_work = std::current_exception();
+			}
+			
+			this->failed.store(true);
+			this->wake();
+			break;
+		}
+		
+		// after queueing sub-nodes, wake waiting threads after last task
+		if (this->pending.fetch_sub(1) == 1)
+		{
+			this->wake();
+		}
+		
+		t0 = clock::now();
+		w->busy += std::chrono::duration<double>(t0 - t1).count();
+		++w->n_task;
+	}
+	
+	w->idle += std::chrono::duration<double>(clock::now() - t0).count();
+}
+
+void SharedPool::run()
+{
+	std::vector<std::thread> t;
+	
+	try
+	{
+		for (int k = 1, n = static_cast<int>(this->worker.size()); k < n; ++k)
+		{
+			t.push_back(std::thread(&SharedPool::work, this, k));
+		}
+	}
+	catch (...)
+	{
+		std::lock_guard<std::mutex> lock(this->ex_idle);
+		this->ex_work = std::current_exception();
+		this->failed.store(true);
+	}
+	
+	this->work(0); // run on this thread
+	
+	for (std::thread & _t : t)
+	{
+		_t.join();
+	}
+	
+	if (this->failed.load())
+	{
+		// discard remaining tasks, reset for next run
+		for (std::unique_ptr<Worker> & w : this->worker)
+		{
+			w->task.clear();
+		}
+		
+		std::exception_ptr ex = this->ex_work;
+		
+		this->pending.store(0);
+		this->queued.store(0);
+		this->failed.store(false);
+		this->ex_work = nullptr;
+		
+		std::rethrow_exception(ex);
+	}
+}
+
+void SharedPool::complete(const Root & root) const
+{
+	if (this->record == nullptr)
+		return;
+	
+	const SourceTable & table = this->source.table();
+	
+	const size_t marker = root.root->type.marker_id;
+	const size_t lstop  = root.top[0]->stop;
+	const size_t rstop  = root.top[1]->stop;
+	
+	std::ostringstream line;
+	
+	line << root.index << ' ';
+	line << table.chr(marker).str() << ' ' << table.pos(marker) << ' ' << table.key(marker) << ' ';
+	line << root.root->type.haplotype.str() << ' ' << root.root->type.sample_id.size() << ' ';
+	line << table.pos(lstop) << ' ' << table.pos(rstop) << ' ';
+	line << std::setprecision(6) << std::fixed << table.dist(lstop) << ' ' << table.dist(rstop) << ' ';
+	line << (table.pos(rstop) - table.pos(lstop)) << ' ' << (table.dist(rstop) - table.dist(lstop)) << ' ';
+	line << root.count[0] << ' ' << root.count[1] << '\n';
+	
+	this->record->push(line.str());
+}
+
+void SharedPool::clear()
+{
+	for (std::unique_ptr<Worker> & w : this->worker)
+	{
+		w->arena.node.clear();
+		w->arena.sample.clear();
+	}
+}
+
+void SharedPool::report(std::ostream & stream) const
+{
+	stream << "Thread usage during scan (thread, busy sec, idle sec, tasks, stolen):" << std::endl;
+	
+	for (size_t k = 0; k < this->worker.size(); ++k)
+	{
+		const Worker * w = this->worker[k].get();
+		
+		stream << ' ' << k << ' ' << std::setprecision(3) << std::fixed << w->busy << ' ' << w->idle << ' ' << w->n_task << ' ' << w->n_steal << std::endl;
+	}
+}
+
+
+
+
+
+//
+// Number of shared haplotypes per pair of samples
+//
+
+SharedMatrix::SharedMatrix(const size_t _n, const size_t _shards)
+: n(_n)
+{
+	const size_t total = this->offset(this->n);
+	const size_t n_shard = std::max(std::min(_shards, this->n), size_t(1));
+	
+	// split rows into blocks of similar number of pairs
+	size_t lo = 0;
+	
+	for (size_t k = 1; k <= n_shard; ++k)
+	{
+		size_t hi = lo;
+		
+		if (k == n_shard)
+		{
+			hi = this->n;
+		}
+		else
+		{
+			while (hi < this->n && this->offset(hi) < total / n_shard * k)
+				++hi;
+		}
+		
+		if (hi == lo && (k != n_shard || ! this->shard.empty())) // skip empty blocks
+			continue;
+		
+		Shard shard;
+		shard.lo     = lo;
+		shard.hi     = hi;
+		shard.base   = this->offset(lo);
+		shard.dense_ = false;
+		
+		this->shard.push_back(std::move(shard));
+		
+		lo = hi;
+	}
+}
+
+size_t SharedMatrix::offset(const size_t x) const
+{
+	return (this->n == 0) ? 0: x * (2 * this->n - x - 1) / 2;
+}
+
+const SharedMatrix::Shard & SharedMatrix::find(const size_t x) const
+{
+	size_t a = 0, b = this->shard.size();
+	
+	// last shard starting at or before row
+	while (b - a > 1)
+	{
+		const size_t m = (a + b) / 2;
+		
+		if (this->shard[m].lo <= x)
+			a = m;
+		else
+			b = m;
+	}
+	
+	return this->shard[a];
+}
+
+SharedMatrix::Shard & SharedMatrix::find(const size_t x)
+{
+	return const_cast<Shard &>(static_cast<const SharedMatrix &>(*this).find(x));
+}
+
+void SharedMatrix::Shard::dense(const SharedMatrix & matrix)
+{
+	if (this->dense_)
+		return;
+	
+	this->tri.assign(matrix.offset(this->hi) - this->base, 0);
+	
+	for (std::unordered_map<uint64_t, uint32_t>::const_iterator it = this->hash.begin(), end = this->hash.end(); it != end; ++it)
+	{
+		const size_t x = it->first >> 32;
+		const size_t y = it->first & 0xFFFFFFFF;
+		
+		this->tri[ matrix.offset(x) + (y - x - 1) - this->base ] = it->second;
+	}
+	
+	std::unordered_map<uint64_t, uint32_t>().swap(this->hash); // release memory
+	
+	this->dense_ = true;
+}
+
+void SharedMatrix::add(size_t x, size_t y, const uint32_t count)
+{
+	if (x == y)
+		return;
+	
+	if (x > y)
+		std::swap(x, y);
+	
+#ifdef DEBUG_SHARED
+	if (y >= this->n)
+	{
+		throw std::out_of_range("Sample pair out of range");
+	}
+#endif
+	
+	Shard & shard = this->find(x);
+	uint32_t * c;
+	
+	if (shard.dense_)
+	{
+		c = &shard.tri[ this->offset(x) + (y - x - 1) - shard.base ];
+	}
+	else
+	{
+		c = &shard.hash[ (uint64_t)x << 32 | (uint64_t)y ];
+		
+		// switch to triangle once sparse hash would need more memory
+		if (shard.hash.size() * SHARED_MATRIX_ENTRY >= (this->offset(shard.hi) - shard.base) * sizeof(uint32_t))
+		{
+			shard.dense(*this);
+			c = &shard.tri[ this->offset(x) + (y - x - 1) - shard.base ];
+		}
+	}
+	
+	*c = (*c > UINT32_MAX - count) ? UINT32_MAX: *c + count; // saturate
+}
+
+uint32_t SharedMatrix::get(size_t x, size_t y) const
+{
+	if (x == y)
+		return 0;
+	
+	if (x > y)
+		std::swap(x, y);
+	
+	const Shard & shard = this->find(x);
+	
+	if (shard.dense_)
+	{
+		return shard.tri[ this->offset(x) + (y - x - 1) - shard.base ];
+	}
+	
+	std::unordered_map<uint64_t, uint32_t>::const_iterator it = shard.hash.find((uint64_t)x << 32 | (uint64_t)y);
+	
+	return (it == shard.hash.end()) ? 0: it->second;
+}
+
+void SharedMatrix::dense()
+{
+	for (Shard & shard : this->shard)
+	{
+		shard.dense(*this);
+	}
+}
+
+size_t SharedMatrix::size() const
+{
+	return this->n;
+}
+
+size_t SharedMatrix::shards() const
+{
+	return this->shard.size();
+}
+
+std::pair<size_t, size_t> SharedMatrix::rows(const size_t k) const
+{
+	return std::make_pair(this->shard[k].lo, this->shard[k].hi);
+}
+
+size_t SharedMatrix::dense_shards() const
+{
+	size_t count = 0;
+	
+	for (const Shard & shard : this->shard)
+	{
+		if (shard.dense_)
+			++count;
+	}
+	
+	return count;
+}
+
+size_t SharedMatrix::nonzero() const
+{
+	size_t count = 0;
+	
+	for (const Shard & shard : this->shard)
+	{
+		if (shard.dense_)
+			count += shard.tri.size() - std::count(shard.tri.begin(), shard.tri.end(), 0);
+		else
+			count += shard.hash.size();
+	}
+	
+	return count;
+}
+
+void SharedMatrix::scatter(Scatter & sc) const
+{
+	sc.by_row.clear();
+	sc.by_col.clear();
+	sc.i_row = 0;
+	sc.i_col = 0;
+	
+	for (const Shard & shard : this->shard)
+	{
+		if (shard.dense_)
+			continue;
+		
+		const size_t first = sc.by_row.size();
+		
+		sc.by_row.insert(sc.by_row.end(), shard.hash.begin(), shard.hash.end());
+		
+		std::sort(sc.by_row.begin() + first, sc.by_row.end()); // shards are in row order
+	}
+	
+	sc.by_col.reserve(sc.by_row.size());
+	
+	for (const std::pair<uint64_t, uint32_t> & p : sc.by_row)
+	{
+		sc.by_col.push_back(std::make_pair((p.first & 0xFFFFFFFF) << 32 | (p.first >> 32), p.second));
+	}
+	
+	std::sort(sc.by_col.begin(), sc.by_col.end());
+}
+
+void SharedMatrix::row(const size_t x, uint32_t * out, Scatter & sc) const
+{
+	std::fill(out, out + this->n, 0);
+	
+	// column x of dense rows above
+	for (const Shard & shard : this->shard)
+	{
+		if (shard.lo >= x)
+			break;
+		
+		if (! shard.dense_)
+			continue;
+		
+		for (size_t y = shard.lo, end = std::min(shard.hi, x); y < end; ++y)
+		{
+			out[y] = shard.tri[ this->offset(y) + (x - y - 1) - shard.base ];
+		}
+	}
+	
+	// dense row x to the right of diagonal
+	const Shard & shard = this->find(x);
+	
+	if (shard.dense_)
+	{
+		std::copy(shard.tri.begin() + (this->offset(x) - shard.base), shard.tri.begin() + (this->offset(x + 1) - shard.base), out + x + 1);
+	}
+	
+	// sparse pairs of row & column x, cursors move on with rows
+	for (; sc.i_row < sc.by_row.size() && (sc.by_row[sc.i_row].first >> 32) == x; ++sc.i_row)
+	{
+		out[ sc.by_row[sc.i_row].first & 0xFFFFFFFF ] = sc.by_row[sc.i_row].second;
+	}
+	
+	for (; sc.i_col < sc.by_col.size() && (sc.by_col[sc.i_col].first >> 32) == x; ++sc.i_col)
+	{
+		out[ sc.by_col[sc.i_col].first & 0xFFFFFFFF ] = sc.by_col[sc.i_col].second;
+	}
+}
+
+void SharedMatrix::print_dense(StreamOut & stream, const Source & source) const
+{
+	std::vector<uint32_t> count(this->n);
+	Scatter sc;
+	
+	this->scatter(sc);
+	
+	// print header columns
+	stream.write('.');
+	for (size_t x = 0; x < this->n; ++x)
+	{
+		stream.write(' ');
+		stream.write(source.sample(x).info.key);
+	}
+	stream.endl();
+	
+	for (size_t x = 0; x < this->n; ++x)
+	{
+		this->row(x, &count[0], sc);
+		
+		stream.write(source.sample(x).info.key); // print sample ID in row
+		
+		for (size_t y = 0; y < this->n; ++y)
+		{
+			stream.write(' ');
+			stream.write_uint(count[y]);
+		}
+		stream.endl();
+	}
+}
+
+void SharedMatrix::print_sparse(StreamOut & stream, const Source & source) const
+{
+	stream.line("sample_id0 sample_id1 shared");
+	
+	auto print = [&stream, &source](const size_t x, const size_t y, const uint32_t count)
+	{
+		stream.write(source.sample(x).info.key);
+		stream.write(' ');
+		stream.write(source.sample(y).info.key);
+		stream.write(' ');
+		stream.write_uint(count);
+		stream.endl();
+	};
+	
+	// shards are in row order
+	for (const Shard & shard : this->shard)
+	{
+		if (shard.dense_)
+		{
+			for (size_t x = shard.lo, i = 0; x < shard.hi; ++x)
+			{
+				for (size_t y = x + 1; y < this->n; ++y, ++i)
+				{
+					if (shard.tri[i] != 0)
+						print(x, y, shard.tri[i]);
+				}
+			}
+		}
+		else
+		{
+			std::vector< std::pair<uint64_t, uint32_t> > pair(shard.hash.begin(), shard.hash.end());
+			
+			std::sort(pair.begin(), pair.end()); // order by first, then second sample
+			
+			for (std::vector< std::pair<uint64_t, uint32_t> >::const_iterator it = pair.begin(), end = pair.end(); it != end; ++it)
+			{
+				print(it->first >> 32, it->first & 0xFFFFFFFF, it->second);
+			}
+		}
+	}
+}
+
+void SharedMatrix::print_binary(StreamOut & stream) const
+{
+	std::vector<uint32_t> count(this->n);
+	Scatter sc;
+	
+	this->scatter(sc);
+	
+	// header
+	stream.write(SHARED_BINARY_MAGIC, 8);
+	stream.write_u32le(SHARED_BINARY_VERSION);
+	stream.write_u32le(sizeof(uint32_t)); // bytes per count
+	stream.write_u64le(this->n);
+	
+	// full matrix, row by row
+	for (size_t x = 0; x < this->n; ++x)
+	{
+		this->row(x, &count[0], sc);
+		
+		for (size_t y = 0; y < this->n; ++y)
+		{
+			stream.write_u32le(count[y]);
+		}
+	}
+}
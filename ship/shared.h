@@ -13,33 +13,48 @@
 #include <stdint.h>
 #include <vector>
 #include <set>
+#include <unordered_map>
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <chrono>
 #include <thread>
 #include <mutex>
+#include <atomic>
 
 #include "types.hpp"
 #include "source.h"
+#include "stream.h"
 
 
 #define DEBUG_SHARED
 
+#define SHARED_MATRIX_SHARDS 4 // shards of sharing matrix per thread
+
 
 //******************************************************************************
 // Shared haplotype containers
 //******************************************************************************
 
 struct SharedType;
-struct SharedTree;
+class  SharedTree;
 struct SharedNode;
 struct SharedRoot;
+struct SharedArena;
+class  SharedPool;
+class  SharedMatrix;
+
+template <class Type>
+class  SharedChunk;
 
 //
 // Shared haplotype
 //
 struct SharedType
 {
-	const Haplotype     haplotype; // shared haplotype
-	const size_t        marker_id; // marker where haplotype is located
-	std::vector<size_t> sample_id; // subsample sharing haplotype
+	const Haplotype       haplotype; // shared haplotype
+	const size_t          marker_id; // marker where haplotype is located
+	std::vector<uint32_t> sample_id; // subsample sharing haplotype, also read by top nodes of scan
 	
 	// construct
 	SharedType(const Haplotype, const size_t);
@@ -47,54 +62,264 @@ struct SharedType
 
 
 //
-// Shared haplotype tree structure
+// Shared haplotype trees, flat storage of nodes in depth-first order
+//
+// Each tree starts with a top node holding the root haplotype and subsample,
+// the sub-tree of node i spans nodes [i, end(i)), its first child is i + 1
+// (if i + 1 < end(i)) and the next sibling of a child j is end(j).
+//
+class SharedTree
+{
+private:
+	
+	std::vector<unsigned char> haplotype_; // shared haplotype
+	std::vector<unsigned char> side_;      // left (0) or right (1) sided scan
+	std::vector<uint32_t>      marker_;    // marker where haplotype is located
+	std::vector<uint32_t>      stop_;      // marker ID at breakpoint
+	std::vector<uint64_t>      parent_;    // parent node, SharedTree::none for top node
+	std::vector<uint64_t>      end_;       // position after sub-tree
+	std::vector<uint64_t>      offset_;    // position of subsample in pooled samples, one extra at end
+	std::vector<uint32_t>      sample_;    // pooled subsamples
+	
+public:
+	
+	static const uint64_t none = UINT64_MAX; // no parent
+	
+	// return number of nodes
+	size_t size() const;
+	
+	// return node properties
+	Haplotype haplotype(const size_t) const;
+	bool      side(const size_t) const;
+	size_t    marker_id(const size_t) const;
+	size_t    stop(const size_t) const;
+	uint64_t  parent(const size_t) const;
+	size_t    end(const size_t) const;
+	
+	// return subsample of node
+	const uint32_t * sample(const size_t) const;
+	size_t sample_size(const size_t) const;
+	
+	// count sub-nodes of node
+	size_t count(const size_t) const;
+	
+	// append node, returns position
+	size_t append(const Haplotype, const bool, const size_t, const size_t, const uint64_t, const uint32_t *, const size_t);
+	
+	// set end of sub-tree
+	void close(const size_t);
+	
+	// write arrays
+	void save(StreamBinaryOut &) const;
+};
+
+
+//
+// Shared haplotype root of tree
+//
+struct SharedRoot
+{
+	SharedType type; // shared haplotype
+	uint64_t ltree, rtree; // top node of left/right tree
+	
+	// get subsample sharing root haplotype
+	void subsample(const Source &);
+	
+	// construct
+	SharedRoot(const Haplotype, const size_t);
+};
+
+
+//
+// Blocks of memory, addresses do not change when growing
 //
-struct SharedTree
+template <class Type>
+class SharedChunk
 {
-	const bool              side; // left (false) or right (true) sided scan
-	size_t                  stop; // marker ID at breakpoint
-	std::vector<SharedNode> node; // node of off-going branches
+private:
+	
+	std::vector< std::unique_ptr<Type[]> > block; // allocated blocks
+	size_t block_size; // size of regular block
+	size_t used;   // used elements in last block
+	size_t avail;  // size of last block
+	size_t total;  // number of elements handed out
+	
+public:
+	
+	// return contiguous memory for n elements
+	Type * alloc(const size_t n)
+	{
+		if (this->used + n > this->avail)
+		{
+			this->avail = std::max(n, this->block_size);
+			this->used  = 0;
+			this->block.push_back(std::unique_ptr<Type[]>(new Type[this->avail]));
+		}
+		
+		Type * ptr = this->block.back().get() + this->used;
+		
+		this->used  += n;
+		this->total += n;
+		
+		return ptr;
+	}
 	
-	// scan structure to create node, recursively
-	void scan(const Source &, const SharedType &); // return breakpoint
+	// return number of elements handed out
+	size_t size() const
+	{
+		return this->total;
+	}
 	
-	// count nodes and sub-nodes
-	size_t count() const;
+	// release all blocks
+	void clear()
+	{
+		this->block.clear();
+		this->used  = 0;
+		this->avail = 0;
+		this->total = 0;
+	}
 	
 	// construct
-	SharedTree(const bool);
+	SharedChunk(const size_t _block_size)
+	: block_size(_block_size)
+	, used(0)
+	, avail(0)
+	, total(0)
+	{}
 };
 
 
 //
-// Shared haplotype node in tree
+// Node while tree is scanned, address is fixed until tree is stored
 //
 struct SharedNode
 {
-	SharedType type; // shared haplotype
-	SharedTree tree; // tree structure
+	Haplotype        haplotype; // shared haplotype
+	bool             side;      // left (false) or right (true) sided scan
+	size_t           marker_id; // marker where haplotype is located
+	size_t           stop;      // marker ID at breakpoint
+	const uint32_t * sample;    // subsample sharing haplotype
+	size_t           n_sample;  // size of subsample
+	SharedNode *     child;     // off-going branches, contiguous
+	size_t           n_child;   // number of off-going branches
+};
+
+
+//
+// Memory of tree scans on one thread
+//
+struct SharedArena
+{
+	std::vector<int>      g0, g1; // haplotypes of subsample at current marker
+	std::vector<uint64_t> b0, b1; // bit-planes of subsample at current biallelic marker
+	std::vector<uint64_t> w0, w1; // words of 64 markers of subsample from sample-major tiles
+	std::vector<uint32_t> bucket; // subsample grouped by haplotype
+	
+	SharedChunk<SharedNode> node;   // scanned nodes
+	SharedChunk<uint32_t>   sample; // subsamples of scanned nodes
+	
+	// scan node until breakpoint, create off-going branches without scanning them
+	void expand(const Source &, SharedNode &);
+	
+	// set up off-going branch of node, return memory for its subsample
+	uint32_t * branch(SharedNode &, const SharedNode &, const Haplotype, const size_t, const size_t);
 	
 	// construct
-	SharedNode(const Haplotype, const size_t, const bool);
+	SharedArena();
 };
 
 
 //
-// Shared haplotype root of tree
+// Work-stealing scheduler for tree scans
 //
-struct SharedRoot
+class SharedPool
 {
-	SharedType type; // shared haplotype
-	SharedTree ltree, rtree; // left/right tree structure
+public:
 	
-	// get subsample sharing root haplotype
-	void subsample(const Source &);
+	// scan state of one root, complete when no node of both trees is pending
+	struct Root
+	{
+		size_t              index; // index of root
+		const SharedRoot *  root;  // root of trees
+		SharedNode *        top[2]; // top node of left & right tree
+		std::atomic<size_t> pending; // number of queued or running nodes
+		std::atomic<size_t> count[2]; // number of sub-nodes of left & right tree
+	};
+	
+private:
+	
+	// expansion of one tree node
+	struct Task
+	{
+		SharedNode * node; // node to expand
+		Root *       root; // root of tree
+		bool         first; // flag that node is first top node of root
+	};
+	
+	// task queue & statistics of one thread
+	struct Worker
+	{
+		std::deque<Task> task; // local tasks, owner works at back, thieves steal at front
+		std::mutex       ex_task; // mutex for local tasks
+		SharedArena      arena; // nodes created by thread
+		double busy; // seconds spent on tasks
+		double idle; // seconds spent waiting for tasks
+		size_t n_task;  // number of executed tasks
+		size_t n_steal; // number of stolen tasks
+		
+		Worker();
+	};
+	
+	const Source & source; // data source
+	ProgressCounter & progress; // progress of root scans
+	StreamQueue<std::string> * record; // records of completed roots, optional
+	std::vector< std::unique_ptr<Worker> > worker; // one worker per thread
+	std::atomic<size_t> pending; // number of queued or running tasks
+	std::atomic<size_t> queued; // number of queued tasks
+	std::atomic<int>    n_idle; // number of threads waiting for tasks
+	std::atomic<bool>   failed; // flag that a task threw an exception
+	std::exception_ptr  ex_work; // first exception thrown by a task
+	std::mutex          ex_idle; // mutex for waiting threads & exception
+	std::condition_variable cv_idle; // wake waiting threads
+	
+	// take task from own queue or steal from others
+	bool take(const int, Task &);
+	
+	// wait until tasks are queued, return false if all are done or failed
+	bool wait();
+	
+	// wake all waiting threads
+	void wake();
+	
+	// run tasks until all are done
+	void work(const int);
+	
+	// pass record of completed root to queue
+	void complete(const Root &) const;
+	
+public:
 	
-	// scan left & right tree
-	void scan(const Source &);
+	// queue node for expansion
+	void push(const int, SharedNode *, Root *, const bool = false);
+	
+	// run on all threads, rethrow first exception of a task
+	void run();
+	
+	// release memory of created nodes
+	void clear();
+	
+	// print busy/idle time of threads
+	void report(std::ostream &) const;
+	
+	// constant header of root records
+	static const std::string header;
 	
 	// construct
-	SharedRoot(const Haplotype, const size_t);
+	SharedPool(const Source &, ProgressCounter &, const int, StreamQueue<std::string> * = nullptr);
+	
+	// do not copy
+	SharedPool(const SharedPool &) = delete;
+	SharedPool & operator = (const SharedPool &) = delete;
 };
 
 
@@ -106,12 +331,18 @@ class Shared
 private:
 	
 	std::vector<SharedRoot> root; // root of shared haplotype structures
+	SharedTree tree_; // scanned trees of all roots
 	size_t size_; // number of shared haplotypes
 	size_t marker_count_; // number of markers
 	
-	// scan with mutliple threads
-	void scan_parallel(const std::vector<size_t> &, const Source &, ProgressBar &);
-	std::mutex ex_scan;
+	// count pairs of adjacent carriers
+	void share_adjacent(SharedMatrix &, ProgressCounter &, const int) const;
+	
+	// count all pairs of carriers in blocks of roots, return number of blocks counted by bitset intersection
+	size_t share_all(SharedMatrix &, ProgressCounter &, const int) const;
+	
+	// append scanned tree of root in depth-first order
+	void store(const SharedNode *);
 	
 public:
 	
@@ -125,8 +356,17 @@ public:
 	// return number of markers
 	size_t marker_count() const;
 	
-	// scan all shared haplotype structures
-	void scan(const Source &, const int);
+	// detect subsamples and count sharing per pair of samples, adjacent carriers or all pairs of carriers
+	void share(const Source &, SharedMatrix &, const int, const bool = false);
+	
+	// scan all shared haplotype structures, optionally write one record per root and keep trees
+	void scan(const Source &, const int, StreamOut * = nullptr, const bool = true);
+	
+	// return scanned trees
+	const SharedTree & tree() const;
+	
+	// write roots & scanned trees into binary file
+	void save(const std::string &) const;
 	
 	// construct
 	Shared(const Source &, const Census &);
@@ -134,5 +374,91 @@ public:
 
 
 
+//
+// Number of shared haplotypes per pair of samples
+//
+class SharedMatrix
+{
+private:
+	
+	// block of rows, only updated by one thread at a time
+	struct Shard
+	{
+		size_t lo, hi; // rows [lo, hi)
+		size_t base; // position of first pair in triangle
+		bool dense_; // flag that triangle is allocated
+		std::vector<uint32_t> tri; // upper triangle without diagonal of rows, row by row
+		std::unordered_map<uint64_t, uint32_t> hash; // sparse pair counts, key is x << 32 | y
+		
+		// convert sparse counts into triangle
+		void dense(const SharedMatrix &);
+	};
+	
+	// sparse counts of all shards in row & column order, for output row by row
+	struct Scatter
+	{
+		std::vector< std::pair<uint64_t, uint32_t> > by_row; // key is x << 32 | y
+		std::vector< std::pair<uint64_t, uint32_t> > by_col; // key is y << 32 | x
+		size_t i_row, i_col; // next pair of current row
+	};
+	
+	size_t n; // number of samples
+	std::vector<Shard> shard; // blocks of rows covering similar number of pairs
+	
+	// position of first pair of row in triangle
+	size_t offset(const size_t) const;
+	
+	// collect sorted sparse counts
+	void scatter(Scatter &) const;
+	
+	// return counts of sample with all samples, symmetric, rows in ascending order
+	void row(const size_t, uint32_t *, Scatter &) const;
+	
+	// return shard holding row
+	const Shard & find(const size_t) const;
+	Shard & find(const size_t);
+	
+public:
+	
+	// add count to pair, symmetric, pairs of same shard must not be added concurrently
+	void add(const size_t, const size_t, const uint32_t = 1);
+	
+	// return count of pair, symmetric
+	uint32_t get(const size_t, const size_t) const;
+	
+	// convert sparse counts into triangle
+	void dense();
+	
+	// return number of samples
+	size_t size() const;
+	
+	// return number of shards
+	size_t shards() const;
+	
+	// return rows [lo, hi) of shard
+	std::pair<size_t, size_t> rows(const size_t) const;
+	
+	// return number of shards with allocated triangle
+	size_t dense_shards() const;
+	
+	// return number of pairs with non-zero count
+	size_t nonzero() const;
+	
+	// write full matrix, one row per sample
+	void print_dense(StreamOut &, const Source &) const;
+	
+	// write one line per pair with non-zero count
+	void print_sparse(StreamOut &, const Source &) const;
+	
+	// write full matrix of 32 bit counts, little-endian, after 24 byte header:
+	// magic "SHIPSHR\0", version (uint32), bytes per count (uint32), number of samples (uint64)
+	// samples are in order of sample file, i.e. numpy.fromfile(f, '<u4', offset=24).reshape(n, n)
+	void print_binary(StreamOut &) const;
+	
+	// construct
+	SharedMatrix(const size_t, const size_t = 1);
+};
+
+
 
 #endif /* defined(__ship__shared__) */
@@ -13,9 +13,13 @@
 // Marker & sample (data matrix) container
 //******************************************************************************
 
+#define SOURCE_SNAPSHOT_MAGIC   0x3143525350494853ULL // "SHIPSRC1"
+#define SOURCE_SNAPSHOT_VERSION 3
 
-Source::Source(const char _collect_data)
-: sample_size_(0)
+
+Source::Source(const char _collect_data, const bool _pack_data)
+: pack_data(_pack_data)
+, sample_size_(0)
 , marker_size_(0)
 , finished(false)
 {
@@ -49,22 +53,18 @@ Source::Source(const char _collect_data)
 	}
 }
 
-Source::Source(const Source & other)
-: collect_data(other.collect_data)
-, sample_(other.sample_)
-, marker_(other.marker_)
-, sample_size_(other.sample_size_)
-, marker_size_(other.marker_size_)
-, finished(other.finished)
-{}
-
 Source::Source(Source && other)
 : collect_data(other.collect_data)
+, pack_data(other.pack_data)
+, chromosome(other.chromosome)
 , sample_(std::move(other.sample_))
 , marker_(std::move(other.marker_))
+, line_(std::move(other.line_))
 , sample_size_(other.sample_size_)
 , marker_size_(other.marker_size_)
 , finished(other.finished)
+, tile_(std::move(other.tile_))
+, table_(std::move(other.table_))
 {}
 
 Source::~Source()
@@ -73,31 +73,21 @@ Source::~Source()
 	this->marker_.clear();
 }
 
-Source & Source::operator = (const Source & other)
-{
-	if (this != &other)
-	{
-		this->collect_data = other.collect_data;
-		this->sample_ = other.sample_;
-		this->marker_ = other.marker_;
-		this->sample_size_ = other.sample_size_;
-		this->marker_size_ = other.marker_size_;
-		this->finished = other.finished;
-	}
-	
-	return *this;
-}
-
 Source & Source::operator = (Source && other)
 {
 	if (this != &other)
 	{
 		this->collect_data = other.collect_data;
+		this->pack_data = other.pack_data;
+		this->chromosome = other.chromosome;
 		this->sample_.swap(other.sample_);
 		this->marker_.swap(other.marker_);
+		this->line_.swap(other.line_);
 		this->sample_size_ = other.sample_size_;
 		this->marker_size_ = other.marker_size_;
 		this->finished = other.finished;
+		this->tile_ = std::move(other.tile_);
+		this->table_ = std::move(other.table_);
 	}
 	
 	return *this;
@@ -117,6 +107,11 @@ void Source::append(Sample && sample)
 }
 
 void Source::append(Marker && marker)
+{
+	this->append(std::move(marker), this->marker_size_); // tag with order of appending
+}
+
+void Source::append(Marker && marker, const size_t line)
 {
 #ifdef DEBUG_SOURCE
 	if (this->finished)
@@ -160,11 +155,22 @@ void Source::append(Marker && marker)
 	if (this->collect_data == CollectData::on_sample)
 		marker.data.remove();
 	
+	// compress marker data, unless packed by caller
+	else if (this->pack_data)
+		marker.data.pack();
+	
 	// append marker
 	this->marker_.push_back(std::move(marker)); // move
+	this->line_.push_back(line);
 	this->marker_size_ += 1;
 }
 
+void Source::pack(Marker & marker) const
+{
+	if (this->pack_data && this->collect_data != CollectData::on_sample)
+		marker.data.pack();
+}
+
 const Sample & Source::sample(const size_t i) const
 {
 #ifdef DEBUG_SOURCE
@@ -179,9 +185,13 @@ const Sample & Source::sample(const size_t i) const
 	return this->sample_[i];
 }
 
-const Marker & Source::marker(const size_t i) const
+SourceMarker Source::marker(const size_t i) const
 {
 #ifdef DEBUG_SOURCE
+	if (! this->finished)
+	{
+		throw std::runtime_error("Appending of markers not completed");
+	}
 	if (i >= this->marker_size_)
 	{
 		throw std::out_of_range("Marker out of range\n"
@@ -190,7 +200,7 @@ const Marker & Source::marker(const size_t i) const
 	}
 #endif
 	
-	return this->marker_[i];
+	return SourceMarker(this->table_, i);
 }
 
 const std::vector<Sample> & Source::sample() const
@@ -205,18 +215,6 @@ const std::vector<Sample> & Source::sample() const
 	return this->sample_;
 }
 
-const std::vector<Marker> & Source::marker() const
-{
-#ifdef DEBUG_SOURCE
-	if (! this->finished)
-	{
-		throw std::runtime_error("Appending of markers not completed");
-	}
-#endif
-	
-	return this->marker_;
-}
-
 size_t Source::sample_size() const
 {
 	return this->sample_size_;
@@ -255,6 +253,8 @@ void Source::finish(const int threads)
 	this->sort(threads);
 	
 	this->finished = true;
+	
+	this->table_.build(std::move(this->marker_));
 }
 
 void Source::sort_subsample(const std::vector<size_t> & subsample, const std::vector<size_t> & order)
@@ -279,42 +279,115 @@ void Source::sort_subsample(const std::vector<size_t> & subsample, const std::ve
 
 void Source::sort(const int threads)
 {
-	std::vector< std::pair<size_t, std::vector<Marker>::iterator> > index; // index of current order
-	std::vector<size_t> order, check; // index order & check index for expected order
-	size_t i = 0;
-	
-	index.resize(this->marker_size_);
-	order.resize(this->marker_size_);
-	check.resize(this->marker_size_);
+	// compact sort key, the markers themselves are only moved once
+	struct Key
+	{
+		size_t pos;   // marker position
+		size_t line;  // input line, breaks ties in order of the input file
+		size_t index; // current index in marker list
+		
+		bool operator < (const Key & other) const
+		{
+			return (this->pos == other.pos) ? (this->line < other.line): (this->pos < other.pos);
+		}
+	};
 	
-	std::iota(check.begin(), check.end(), 0); // fill vector with increasing index
+	const size_t n = this->marker_size_;
+	const size_t n_line = this->line_.size();
+	std::vector<Key> key(n);
+	std::vector<size_t> order(n); // index order
 	
-	// determine order for index
-	for (std::vector<Marker>::iterator it = this->marker_.begin(), end = this->marker_.end(); it != end; ++it)
+	for (size_t i = 0; i < n; ++i)
 	{
-		index[i] = std::pair<size_t, std::vector<Marker>::iterator>(i, it);
-		++i;
+		key[i].pos   = this->marker_[i].info.pos;
+		key[i].line  = (n_line == n) ? this->line_[i]: i;
+		key[i].index = i;
 	}
 	
-	// sort index by marker position
-	std::sort(index.begin(), index.end(),
-			  [] (const std::pair<size_t, std::vector<Marker>::iterator> & a,
-				  const std::pair<size_t, std::vector<Marker>::iterator> & b) -> bool
-			  { return a.second->info.pos < b.second->info.pos; }
-			  );
-	
-	// determine order
-	std::transform(index.begin(), index.end(), order.begin(),
-				   [] (const std::pair<size_t, std::vector<Marker>::iterator> & a) -> size_t
-				   { return a.first ; }
-				   );
+	std::vector<size_t>().swap(this->line_); // release input lines
 	
 	// stop if sorting is not necessary
-	if (std::equal(order.begin(), order.end(), check.begin()))
+	if (std::is_sorted(key.begin(), key.end()))
 		return;
 	
-	// sort markers
-	std::sort(this->marker_.begin(), this->marker_.end());
+	// run jobs on all threads
+	auto parallel = [threads] (const size_t jobs, const std::function<void (const size_t)> & job)
+	{
+		std::atomic<size_t> next(0);
+		
+		auto work = [&next, jobs, &job]()
+		{
+			for (size_t j = next++; j < jobs; j = next++)
+			{
+				job(j);
+			}
+		};
+		
+		std::vector<std::thread> t;
+		
+		for (int k = 1; k < threads && static_cast<size_t>(k) < jobs; ++k)
+		{
+			t.push_back(std::thread(work));
+		}
+		
+		work(); // on this thread
+		
+		for (std::thread & _t : t)
+		{
+			_t.join();
+		}
+	};
+	
+	// sort key in one range per thread, then merge ranges pairwise
+	const size_t width = (n + threads - 1) / threads;
+	
+	parallel((n + width - 1) / width, [&key, n, width] (const size_t j)
+	{
+		std::sort(key.begin() + j * width, key.begin() + std::min(n, (j + 1) * width));
+	});
+	
+	for (size_t w = width; w < n; w *= 2)
+	{
+		parallel((n + 2 * w - 1) / (2 * w), [&key, n, w] (const size_t j)
+		{
+			const size_t begin = j * 2 * w;
+			const size_t mid   = std::min(n, begin + w);
+			const size_t end   = std::min(n, begin + 2 * w);
+			
+			if (mid < end)
+				std::inplace_merge(key.begin() + begin, key.begin() + mid, key.begin() + end);
+		});
+	}
+	
+	// determine order
+	for (size_t i = 0; i < n; ++i)
+	{
+		order[i] = key[i].index;
+	}
+	
+	std::vector<Key>().swap(key);
+	
+	// permute markers in place, following each cycle of the order
+	std::vector<bool> done(n, false);
+	
+	for (size_t i = 0; i < n; ++i)
+	{
+		if (done[i] || order[i] == i)
+			continue;
+		
+		Marker marker(std::move(this->marker_[i]));
+		size_t j = i;
+		
+		while (order[j] != i)
+		{
+			this->marker_[j] = std::move(this->marker_[order[j]]);
+			done[j] = true;
+			j = order[j];
+		}
+		
+		this->marker_[j] = std::move(marker);
+		done[j] = true;
+	}
 	
 	// sort data in each sample
 	if (this->collect_data == CollectData::on_sample ||
@@ -324,7 +397,7 @@ void Source::sort(const int threads)
 		std::vector< std::vector<size_t> > subsample(threads);
 		
 		int k = 0;
-		for (i = 0; i < this->sample_size_; ++i)
+		for (size_t i = 0; i < this->sample_size_; ++i)
 		{
 			subsample[k++].push_back(i);
 			
@@ -346,5 +419,581 @@ void Source::sort(const int threads)
 	}
 }
 
+void Source::save(const std::string & filename, const uint64_t key) const
+{
+#ifdef DEBUG_SOURCE
+	if (! this->finished)
+	{
+		throw std::runtime_error("Appending of markers not completed");
+	}
+#endif
+	
+	if (this->collect_data != CollectData::on_marker)
+	{
+		throw std::logic_error("Snapshot requires data allocated by marker");
+	}
+	
+	StreamBinaryOut out(filename);
+	
+	// header
+	out.put<uint64_t>(SOURCE_SNAPSHOT_MAGIC);
+	out.put<uint32_t>(SOURCE_SNAPSHOT_VERSION);
+	out.put<uint64_t>(key);
+	out.put<uint64_t>(this->sample_size_);
+	out.put<uint64_t>(this->marker_size_);
+	out.put<int32_t>((int)this->chromosome);
+	
+	// samples
+	for (const Sample & sample : this->sample_)
+	{
+		out.put(sample.info.key);
+		out.put(sample.info.pop);
+		out.put(sample.info.grp);
+	}
+	
+	// marker columns
+	std::vector<int32_t>  chr(this->marker_size_);
+	std::vector<uint64_t> pos(this->marker_size_);
+	std::vector<double>   rate(this->marker_size_), dist(this->marker_size_);
+	std::vector<char>     source(this->marker_size_);
+	
+	for (size_t i = 0; i < this->marker_size_; ++i)
+	{
+		const MarkerGmap gmap = this->table_.gmap(i);
+		
+		chr[i]    = (int)this->table_.chr(i);
+		pos[i]    = this->table_.pos(i);
+		rate[i]   = gmap.rate;
+		dist[i]   = gmap.dist;
+		source[i] = gmap.source;
+	}
+	
+	out.put(chr);
+	out.put(pos);
+	out.put(rate);
+	out.put(dist);
+	out.put(source);
+	
+	for (size_t i = 0; i < this->marker_size_; ++i)
+	{
+		const AlleleList & allele = this->table_.allele(i);
+		
+		out.put(this->table_.key(i));
+		out.put<uint32_t>(allele.size());
+		
+		for (int k = 0; k < allele.size(); ++k)
+			out.put(allele[k].base());
+	}
+	
+	for (size_t i = 0; i < this->marker_size_; ++i)
+	{
+		this->table_.data(i).save(out);
+	}
+	
+	for (size_t i = 0; i < this->marker_size_; ++i)
+	{
+		this->table_.stat(i).save(out);
+	}
+	
+	out.close();
+}
 
+bool Source::load(const std::string & filename, const uint64_t key)
+{
+#ifdef DEBUG_SOURCE
+	if (this->finished || this->sample_size_ != 0 || this->marker_size_ != 0)
+	{
+		throw std::runtime_error("Source already filled");
+	}
+#endif
+	
+	if (this->collect_data != CollectData::on_marker)
+	{
+		throw std::logic_error("Snapshot requires data allocated by marker");
+	}
+	
+	// all columns & genotype planes are copied out of the mapped file, which is
+	// unmapped on return; a loaded source does not depend on the snapshot file
+	StreamBinaryIn in(filename);
+	
+	if (! in.good())
+		return false;
+	
+	// header
+	if (in.get<uint64_t>() != SOURCE_SNAPSHOT_MAGIC ||
+		in.get<uint32_t>() != SOURCE_SNAPSHOT_VERSION ||
+		in.get<uint64_t>() != key)
+	{
+		return false;
+	}
+	
+	const size_t n_sample = in.get<uint64_t>();
+	const size_t n_marker = in.get<uint64_t>();
+	
+	this->chromosome = in.get<int32_t>();
+	
+	// samples
+	this->sample_.resize(n_sample);
+	
+	for (Sample & sample : this->sample_)
+	{
+		sample.info.key = in.str();
+		sample.info.pop = in.str();
+		sample.info.grp = in.str();
+	}
+	
+	// marker columns
+	std::vector<int32_t>  chr;
+	std::vector<uint64_t> pos;
+	std::vector<double>   rate, dist;
+	std::vector<char>     source;
+	
+	in.get(chr);
+	in.get(pos);
+	in.get(rate);
+	in.get(dist);
+	in.get(source);
+	
+	if (chr.size() != n_marker || pos.size() != n_marker || rate.size() != n_marker ||
+		dist.size() != n_marker || source.size() != n_marker)
+	{
+		throw std::runtime_error("Invalid snapshot file: " + filename);
+	}
+	
+	this->marker_.reserve(n_marker);
+	
+	for (size_t i = 0; i < n_marker; ++i)
+	{
+		Marker marker(0);
+		
+		marker.info.chr    = chr[i];
+		marker.info.pos    = pos[i];
+		marker.info.key    = in.str();
+		marker.gmap.rate   = rate[i];
+		marker.gmap.dist   = dist[i];
+		marker.gmap.source = source[i];
+		
+		const uint32_t n_allele = in.get<uint32_t>();
+		
+		for (uint32_t k = 0; k < n_allele; ++k)
+			marker.info.allele.append(Allele(in.str()));
+		
+		this->marker_.push_back(std::move(marker));
+	}
+	
+	for (Marker & marker : this->marker_)
+	{
+		marker.data.load(in);
+		
+		if (marker.data.size() != n_sample)
+			throw std::runtime_error("Invalid snapshot file: " + filename);
+	}
+	
+	// marker stats as evaluated when parsed
+	for (Marker & marker : this->marker_)
+	{
+		marker.stat.load(in);
+		
+		if (marker.stat.haplotype_size() != marker.info.allele.size())
+			throw std::runtime_error("Invalid snapshot file: " + filename);
+	}
+	
+	this->sample_size_ = n_sample;
+	this->marker_size_ = n_marker;
+	
+	this->finished = true;
+	
+	this->table_.build(std::move(this->marker_));
+	
+	return true;
+}
 
+void Source::tile(const int threads)
+{
+#ifdef DEBUG_SOURCE
+	if (! this->finished)
+	{
+		throw std::runtime_error("Appending of markers not completed");
+	}
+#endif
+	
+	this->tile_.build(*this, threads);
+}
+
+const SourceTile & Source::tile() const
+{
+	return this->tile_;
+}
+
+const SourceTable & Source::table() const
+{
+	return this->table_;
+}
+
+void Source::carrier(const Census & cutoff, const int threads)
+{
+	std::atomic<size_t> next(0);
+	
+	auto work = [this, &next, &cutoff]()
+	{
+		for (size_t i = next++; i < this->marker_size_; i = next++)
+		{
+			this->table_.carrier(i).evaluate(this->table_.stat(i), this->table_.data(i), cutoff);
+		}
+	};
+	
+	std::vector<std::thread> t;
+	
+	for (int k = 1; k < threads; ++k)
+	{
+		t.push_back(std::thread(work));
+	}
+	
+	work(); // on this thread
+	
+	for (std::thread & _t : t)
+	{
+		_t.join();
+	}
+}
+
+
+//
+// Sample-major copy of binary genotype data
+//
+
+SourceTile::SourceTile()
+: n_sample(0)
+, n_marker(0)
+, n_sblock(0)
+{}
+
+size_t SourceTile::index(const size_t x, const size_t m) const
+{
+	return (((m / SOURCE_TILE_MARKERS) * this->n_sblock + x / SOURCE_TILE_SAMPLES) * SOURCE_TILE_SAMPLES + x % SOURCE_TILE_SAMPLES) * (SOURCE_TILE_MARKERS / 64) + (m % SOURCE_TILE_MARKERS) / 64;
+}
+
+bool SourceTile::empty() const
+{
+	return this->binary_.empty();
+}
+
+bool SourceTile::is_binary(const size_t m) const
+{
+	return (this->binary_[m] != 0);
+}
+
+uint64_t SourceTile::word0(const size_t x, const size_t m) const
+{
+	return this->plane0[ this->index(x, m) ];
+}
+
+uint64_t SourceTile::word1(const size_t x, const size_t m) const
+{
+	return this->plane1[ this->index(x, m) ];
+}
+
+void SourceTile::clear()
+{
+	std::vector<uint64_t>().swap(this->plane0);
+	std::vector<uint64_t>().swap(this->plane1);
+	std::vector<unsigned char>().swap(this->binary_);
+	
+	this->n_sample = 0;
+	this->n_marker = 0;
+	this->n_sblock = 0;
+}
+
+// transpose 64 x 64 bit matrix, bit c of row r becomes bit r of row c
+static void transpose64(uint64_t * a)
+{
+	uint64_t m = 0x00000000FFFFFFFFULL;
+	
+	for (int j = 32; j != 0; j >>= 1, m ^= (m << j))
+	{
+		for (int k = 0; k < 64; k = ((k | j) + 1) & ~j)
+		{
+			const uint64_t t = ((a[k] >> j) ^ a[k | j]) & m;
+			
+			a[k | j] ^= t;
+			a[k]     ^= t << j;
+		}
+	}
+}
+
+void SourceTile::build(const Source & source, const int threads)
+{
+	this->clear();
+	
+	this->n_sample = source.sample_size();
+	this->n_marker = source.marker_size();
+	this->n_sblock = (this->n_sample + SOURCE_TILE_SAMPLES - 1) / SOURCE_TILE_SAMPLES;
+	
+	const size_t n_mblock = (this->n_marker + SOURCE_TILE_MARKERS - 1) / SOURCE_TILE_MARKERS;
+	const size_t n_word   = n_mblock * this->n_sblock * SOURCE_TILE_SAMPLES * (SOURCE_TILE_MARKERS / 64);
+	
+	this->binary_.resize(this->n_marker);
+	this->plane0.assign(n_word, 0);
+	this->plane1.assign(n_word, 0);
+	
+	for (size_t m = 0; m < this->n_marker; ++m)
+	{
+		this->binary_[m] = (source.table().is_binary(m)) ? 1: 0;
+	}
+	
+	std::atomic<size_t> next(0);
+	
+	// each block of markers is transposed by one thread, 64 x 64 bits at once
+	auto work = [this, &source, &next, n_mblock]()
+	{
+		uint64_t a0[64], a1[64];
+		
+		for (size_t mb = next++; mb < n_mblock; mb = next++)
+		{
+			for (size_t mw = mb * SOURCE_TILE_MARKERS; mw < std::min((mb + 1) * SOURCE_TILE_MARKERS, this->n_marker); mw += 64)
+			{
+				for (size_t sb = 0; sb < this->n_sblock; ++sb)
+				{
+					// rows are markers, columns are samples
+					for (size_t k = 0; k < 64; ++k)
+					{
+						const size_t m = mw + k;
+						
+						if (m < this->n_marker && this->binary_[m] != 0)
+						{
+							a0[k] = source.table().data(m).plane(0)[sb];
+							a1[k] = source.table().data(m).plane(1)[sb];
+						}
+						else
+						{
+							a0[k] = 0;
+							a1[k] = 0;
+						}
+					}
+					
+					transpose64(a0);
+					transpose64(a1);
+					
+					// rows are samples, columns are markers
+					const size_t i = this->index(sb * SOURCE_TILE_SAMPLES, mw);
+					
+					for (size_t k = 0; k < 64; ++k)
+					{
+						this->plane0[i + k * (SOURCE_TILE_MARKERS / 64)] = a0[k];
+						this->plane1[i + k * (SOURCE_TILE_MARKERS / 64)] = a1[k];
+					}
+				}
+			}
+		}
+	};
+	
+	std::vector<std::thread> t;
+	
+	for (int k = 1; k < threads; ++k)
+	{
+		t.push_back(std::thread(work));
+	}
+	
+	work(); // on this thread
+	
+	for (std::thread & _t : t)
+	{
+		_t.join();
+	}
+}
+
+
+//
+// Column-oriented table of marker fields
+//
+
+SourceTable::SourceTable()
+: n_marker(0)
+{}
+
+bool SourceTable::empty() const
+{
+	return (this->n_marker == 0);
+}
+
+size_t SourceTable::size() const
+{
+	return this->n_marker;
+}
+
+const Chromosome & SourceTable::chr(const size_t m) const
+{
+	return this->chr_[m];
+}
+
+size_t SourceTable::pos(const size_t m) const
+{
+	return this->pos_[m];
+}
+
+double SourceTable::dist(const size_t m) const
+{
+	return this->dist_[m];
+}
+
+bool SourceTable::is_binary(const size_t m) const
+{
+	return (this->binary_[m] != 0);
+}
+
+int SourceTable::allele_size(const size_t m) const
+{
+	return this->stat_[m].haplotype_size();
+}
+
+size_t SourceTable::allele_count(const size_t m, const int h) const
+{
+	return static_cast<size_t>(this->stat_[m].haplotype(h));
+}
+
+std::string SourceTable::key(const size_t m) const
+{
+	return this->key_.substr(this->key_begin_[m], this->key_begin_[m + 1] - this->key_begin_[m]);
+}
+
+const AlleleList & SourceTable::allele(const size_t m) const
+{
+	return this->allele_[m];
+}
+
+MarkerInfo SourceTable::info(const size_t m) const
+{
+	MarkerInfo info;
+	
+	info.chr    = this->chr_[m];
+	info.pos    = this->pos_[m];
+	info.key    = this->key(m);
+	info.allele = this->allele_[m];
+	
+	return info;
+}
+
+MarkerGmap SourceTable::gmap(const size_t m) const
+{
+	MarkerGmap gmap;
+	
+	gmap.rate   = this->rate_[m];
+	gmap.dist   = this->dist_[m];
+	gmap.source = this->source_[m];
+	
+	return gmap;
+}
+
+const MarkerStat & SourceTable::stat(const size_t m) const
+{
+	return this->stat_[m];
+}
+
+const MarkerData & SourceTable::data(const size_t m) const
+{
+	return this->data_[m];
+}
+
+const MarkerCarrier & SourceTable::carrier(const size_t m) const
+{
+	return this->carrier_[m];
+}
+
+MarkerCarrier & SourceTable::carrier(const size_t m)
+{
+	return this->carrier_[m];
+}
+
+void SourceTable::clear()
+{
+	std::vector<Chromosome>().swap(this->chr_);
+	std::vector<size_t>().swap(this->pos_);
+	std::string().swap(this->key_);
+	std::vector<size_t>().swap(this->key_begin_);
+	std::vector<AlleleList>().swap(this->allele_);
+	std::vector<double>().swap(this->rate_);
+	std::vector<double>().swap(this->dist_);
+	std::vector<char>().swap(this->source_);
+	std::vector<unsigned char>().swap(this->binary_);
+	std::vector<MarkerStat>().swap(this->stat_);
+	std::vector<MarkerData>().swap(this->data_);
+	std::vector<MarkerCarrier>().swap(this->carrier_);
+	
+	this->n_marker = 0;
+}
+
+void SourceTable::build(std::vector<Marker> && marker)
+{
+	this->clear();
+	
+	this->n_marker = marker.size();
+	
+	this->chr_.reserve(this->n_marker);
+	this->pos_.reserve(this->n_marker);
+	this->key_begin_.reserve(this->n_marker + 1);
+	this->allele_.reserve(this->n_marker);
+	this->rate_.reserve(this->n_marker);
+	this->dist_.reserve(this->n_marker);
+	this->source_.reserve(this->n_marker);
+	this->binary_.reserve(this->n_marker);
+	this->stat_.reserve(this->n_marker);
+	this->data_.reserve(this->n_marker);
+	this->carrier_.reserve(this->n_marker);
+	
+	for (Marker & m : marker)
+	{
+		this->chr_.push_back(m.info.chr);
+		this->pos_.push_back(m.info.pos);
+		
+		this->key_begin_.push_back(this->key_.size());
+		this->key_.append(m.info.key);
+		
+		this->allele_.push_back(std::move(m.info.allele)); // move
+		this->rate_.push_back(m.gmap.rate);
+		this->dist_.push_back(m.gmap.dist);
+		this->source_.push_back(m.gmap.source);
+		this->binary_.push_back(m.data.is_binary());
+		this->stat_.push_back(std::move(m.stat)); // move
+		this->data_.push_back(std::move(m.data)); // move
+		this->carrier_.push_back(std::move(m.carrier)); // move
+	}
+		
+	this->key_begin_.push_back(this->key_.size());
+	
+	std::vector<Marker>().swap(marker); // release
+}
+	
+
+//
+// View of one marker in the column table
+//
+
+SourceMarker::SourceMarker(const SourceTable & _table, const size_t _m)
+: table(_table)
+, m(_m)
+{}
+
+MarkerInfo SourceMarker::info() const
+{
+	return this->table.info(this->m);
+}
+
+MarkerGmap SourceMarker::gmap() const
+{
+	return this->table.gmap(this->m);
+}
+
+const MarkerStat & SourceMarker::stat() const
+{
+	return this->table.stat(this->m);
+}
+
+const MarkerData & SourceMarker::data() const
+{
+	return this->table.data(this->m);
+}
+
+const MarkerCarrier & SourceMarker::carrier() const
+{
+	return this->table.carrier(this->m);
+}
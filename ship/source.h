@@ -16,6 +16,8 @@
 #include <numeric>
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <string>
 
 #include "marker.h"
 #include "sample.h"
@@ -28,6 +30,161 @@
 //******************************************************************************
 // Marker & sample (data matrix) container
 //******************************************************************************
+
+#define SOURCE_TILE_SAMPLES 64   // samples per tile
+#define SOURCE_TILE_MARKERS 4096 // markers per tile
+
+class Source;
+
+//
+// Sample-major copy of binary genotype data, tiles of 64 samples x 4096 markers
+//
+// Within a tile each sample holds 64 consecutive words per bit-plane, bit k of
+// word w is marker 64w + k of the tile. Markers not stored in bit-planes only
+// (see MarkerData::is_binary) are flagged and left empty.
+//
+// Doubles memory of binary genotype data; pays off for dense sharing or many
+// samples, where scans read few bits of many markers per sample.
+//
+class SourceTile
+{
+private:
+	
+	size_t n_sample; // number of samples
+	size_t n_marker; // number of markers
+	size_t n_sblock; // number of sample blocks
+	std::vector<uint64_t> plane0; // bit-plane of 1st haplotypes
+	std::vector<uint64_t> plane1; // bit-plane of 2nd haplotypes
+	std::vector<unsigned char> binary_; // flag that marker is binary
+	
+	// position of word holding sample & marker
+	size_t index(const size_t, const size_t) const;
+	
+public:
+	
+	// check if tiles are built
+	bool empty() const;
+	
+	// check if marker is stored in tiles
+	bool is_binary(const size_t) const;
+	
+	// return 64 markers of sample, aligned to 64 markers, 1st/2nd haplotype
+	uint64_t word0(const size_t, const size_t) const;
+	uint64_t word1(const size_t, const size_t) const;
+	
+	// build tiles from marker data
+	void build(const Source &, const int);
+	
+	// release memory
+	void clear();
+	
+	// construct
+	SourceTile();
+};
+
+
+//
+// Column-oriented table of marker fields, in marker order
+//
+// Owns the fields of all markers once finished. Fields read in hot loops are
+// plain arrays, marker IDs are pooled into one string indexed by per-marker
+// offsets, allele counts are read from the stats column. See SourceMarker for
+// a view of all fields of one marker.
+//
+class SourceTable
+{
+private:
+	
+	size_t n_marker; // number of markers
+	std::vector<Chromosome> chr_; // chromosome
+	std::vector<size_t> pos_; // position
+	std::string key_; // marker IDs of all markers
+	std::vector<size_t> key_begin_; // first character of marker ID, plus end
+	std::vector<AlleleList> allele_; // allele list
+	std::vector<double> rate_; // recombination rate (cM/Mb)
+	std::vector<double> dist_; // genetic distance (cM)
+	std::vector<char> source_; // source of genetic map position
+	std::vector<unsigned char> binary_; // flag that marker is binary (see MarkerData::is_binary)
+	std::vector<MarkerStat> stat_; // marker stats
+	std::vector<MarkerData> data_; // genotype data
+	std::vector<MarkerCarrier> carrier_; // carriers of rare haplotypes
+	
+public:
+	
+	// check if table is built
+	bool empty() const;
+	
+	// return number of markers
+	size_t size() const;
+	
+	// return chromosome/position/genetic distance of marker
+	const Chromosome & chr(const size_t) const;
+	size_t pos(const size_t) const;
+	double dist(const size_t) const;
+	
+	// check if marker is binary
+	bool is_binary(const size_t) const;
+	
+	// return number of alleles/count of allele of marker
+	int allele_size(const size_t) const;
+	size_t allele_count(const size_t, const int) const;
+	
+	// return marker ID
+	std::string key(const size_t) const;
+	
+	// return allele list of marker
+	const AlleleList & allele(const size_t) const;
+	
+	// return marker information/genetic map position, composed of columns
+	MarkerInfo info(const size_t) const;
+	MarkerGmap gmap(const size_t) const;
+	
+	// return stats/data/carriers of marker
+	const MarkerStat & stat(const size_t) const;
+	const MarkerData & data(const size_t) const;
+	const MarkerCarrier & carrier(const size_t) const;
+	MarkerCarrier & carrier(const size_t);
+	
+	// build table by moving fields out of finished markers, which are released
+	void build(std::vector<Marker> &&);
+	
+	// release memory
+	void clear();
+	
+	// construct
+	SourceTable();
+};
+
+
+//
+// View of one marker in the column table
+//
+class SourceMarker
+{
+private:
+	
+	const SourceTable & table; // table of source
+	const size_t m; // marker index
+	
+public:
+	
+	// return marker information/genetic map position (composed)
+	MarkerInfo info() const;
+	MarkerGmap gmap() const;
+	
+	// return stats/data/carriers
+	const MarkerStat & stat() const;
+	const MarkerData & data() const;
+	const MarkerCarrier & carrier() const;
+	
+	// construct
+	SourceMarker(const SourceTable &, const size_t);
+};
+
+
+//
+// Marker & sample container
+//
 class Source
 {
 private:
@@ -40,14 +197,18 @@ private:
 	};
 	
 	CollectData collect_data; // memory allocation setting of data
+	bool pack_data; // flag that marker data is stored in bit-planes
 	Chromosome chromosome; // chromosome of source
 	std::vector<Sample> sample_; // list of samples & data
-	std::vector<Marker> marker_; // list of markers
+	std::vector<Marker> marker_; // list of markers, moved into table when finished
+	std::vector<size_t> line_; // input line of each marker, kept until sorted
 	size_t sample_size_; // number of samples
 	size_t marker_size_; // number of markers
 	bool finished; // flag that appending was finished
+	SourceTile tile_; // sample-major copy of data, optional
+	SourceTable table_; // column-oriented marker fields, owning when finished
 	
-	// sort data matrix
+	// sort data matrix by marker position, ties by input line
 	void sort(const int);
 	void sort_subsample(const std::vector<size_t> &, const std::vector<size_t> &); // multi-threading enabled
 	
@@ -56,31 +217,54 @@ public:
 	// finish by sorting markers
 	void finish(const int);
 	
+	// write finished source to binary snapshot, keyed by fingerprint of inputs
+	void save(const std::string &, const uint64_t) const;
+	
+	// read finished source from binary snapshot (copied), return false if missing or key differs
+	bool load(const std::string &, const uint64_t);
+	
+	// index carriers of rare haplotypes in all markers
+	void carrier(const Census &, const int);
+	
+	// build sample-major tiles of binary data
+	void tile(const int);
+	
+	// return sample-major tiles, empty if not built
+	const SourceTile & tile() const;
+	
+	// return column-oriented marker fields, filled when finished
+	const SourceTable & table() const;
+	
 	// return marker/sample size
 	size_t sample_size() const;
 	size_t marker_size() const;
 	
-	// return marker/sample reference
+	// return sample reference/marker view
 	const Sample & sample(const size_t) const;
-	const Marker & marker(const size_t) const;
+	SourceMarker marker(const size_t) const;
 	
-	// return marker/sample vector reference
+	// return sample vector reference
 	const std::vector<Sample> & sample() const;
-	const std::vector<Marker> & marker() const;
 	
 	// append marker/sample
 	void append(Sample &&); // move
 	void append(Marker &&); // move
+	void append(Marker &&, const size_t); // move, tagged with input line
+	
+	// compress marker data as stored on append, callable without lock
+	void pack(Marker &) const;
 	
 	// assign
-	Source & operator = (const Source &);
 	Source & operator = (Source &&);
 	
 	// construct
-	Source(const char);
-	Source(const Source &);
+	Source(const char, const bool = false);
 	Source(Source &&);
 	
+	// do not copy
+	Source(const Source &) = delete;
+	Source & operator = (const Source &) = delete;
+	
 	// destruct
 	~Source();
 };
@@ -17,6 +17,33 @@
 //******************************************************************************
 
 #define READ_BUFFER_SIZE 33554431 // 32 Mb - 1 byte
+#define BGZF_HEADER_SIZE 12 // fixed part of gzip header in BGZF block
+#define BGZF_FOOTER_SIZE 8  // CRC32 & ISIZE
+#define BGZF_BLOCK_SIZE  65536 // max size of BGZF block
+#define MAP_INDEX_SIZE   1048576 // min number of bytes per thread indexing newlines (1 Mb)
+#define STREAM_OUT_BUFFER 1048576 // size of output buffer (1 Mb)
+#define STREAM_OUT_QUEUE  4 // number of buffers queued for compression
+
+// detect BGZF block size in extra field of gzip header, return zero if not found
+static size_t bgzf_bsize(const unsigned char * extra, const size_t xlen)
+{
+	size_t i = 0;
+	
+	// walkabout extra subfields
+	while (i + 4 <= xlen)
+	{
+		const size_t slen = extra[i + 2] | (extra[i + 3] << 8);
+		
+		if (extra[i] == 'B' && extra[i + 1] == 'C' && slen == 2 && i + 6 <= xlen)
+		{
+			return (extra[i + 4] | (extra[i + 5] << 8)) + 1;
+		}
+		
+		i += 4 + slen;
+	}
+	
+	return 0;
+}
 
 StreamLine::StreamLine()
 : opened(false)
@@ -29,6 +56,19 @@ StreamLine::StreamLine()
 , use(cache.cbegin())
 , end(cache.cend())
 , eof(false)
+, cmpr(false)
+, bgzf(false)
+, mapped(false)
+, map(NULL)
+, map_size(0)
+, newline_i(0)
+, indexed(false)
+, n_thread(std::max(1, (int)std::thread::hardware_concurrency()))
+, inflated_pos(0)
+, bgzf_pos(0)
+, range_i(0)
+, range_seek(false)
+, range_back('\n')
 {}
 
 StreamLine::StreamLine(const std::string & filename)
@@ -44,24 +84,281 @@ StreamLine::~StreamLine()
 
 void StreamLine::gzip()
 {
-	int c0, c1;
+	unsigned char head[BGZF_BLOCK_SIZE];
 	
 	FILE * file = fopen(this->file.c_str(), "rb");
 	if (file == NULL)
 		throw std::runtime_error("Cannot open file: " + this->file);
 	
-	c0 = fgetc(file);
-	c1 = fgetc(file);
+	const size_t n = fread(head, sizeof(char), BGZF_HEADER_SIZE, file);
 	
-	if (feof(file) || ferror(file))
+	if (n < 2 || ferror(file))
 		throw std::runtime_error("Cannot read file: " + this->file);
 	
 	// magic number
-	this->cmpr = (c0 == 0x1f && c1 == 0x8b);
+	this->cmpr = (head[0] == 0x1f && head[1] == 0x8b);
+	
+	// deflate with extra field, containing block size
+	this->bgzf = false;
+	
+	if (this->cmpr && n == BGZF_HEADER_SIZE && head[2] == 8 && (head[3] & 4) != 0)
+	{
+		const size_t xlen = head[10] | (head[11] << 8);
+		
+		if (BGZF_HEADER_SIZE + xlen <= BGZF_BLOCK_SIZE &&
+			fread(head + BGZF_HEADER_SIZE, sizeof(char), xlen, file) == xlen)
+		{
+			this->bgzf = (bgzf_bsize(head + BGZF_HEADER_SIZE, xlen) != 0);
+		}
+	}
 	
 	fclose(file);
 }
 
+bool StreamLine::inflate()
+{
+	unsigned char * head;
+	size_t out = 0;
+	size_t skip = 0; // bytes to skip in first block of range
+	size_t last = SIZE_MAX; // offset of last block to read
+	bool tail = false; // flag that last line of range is completed
+	
+	this->block.clear();
+	this->deflated.clear();
+	this->inflated_pos = 0;
+	
+	// proceed to range
+	while (! this->range.empty())
+	{
+		if (this->range_i == this->range.size())
+		{
+			this->inflated.clear();
+			return false;
+		}
+		
+		const std::pair<uint64_t, uint64_t> & r = this->range[this->range_i];
+		
+		if (this->range_seek)
+		{
+			this->bgzf_pos = (size_t)(r.first >> 16);
+			
+			if (fseek(this->stream.fp, (long)this->bgzf_pos, SEEK_SET) != 0)
+				throw std::runtime_error("Exception while handling compressed file: " + this->file);
+			
+			skip = (size_t)(r.first & 0xffff);
+			
+			this->range_seek = false;
+			this->range_back = '\n';
+		}
+		
+		last = (size_t)(r.second >> 16);
+		tail = (this->bgzf_pos > last);
+		
+		// range ends with complete line
+		if (tail && this->range_back == '\n')
+		{
+			++this->range_i;
+			this->range_seek = true;
+			continue;
+		}
+		
+		break;
+	}
+	
+	// read batch of blocks, or single block past range
+	while (out < (size_t)this->length && (tail ? this->block.empty(): this->bgzf_pos <= last))
+	{
+		const size_t in = this->deflated.size();
+		
+		this->deflated.resize(in + BGZF_BLOCK_SIZE);
+		head = reinterpret_cast<unsigned char *>(&this->deflated[in]);
+		
+		const size_t n = fread(head, sizeof(char), BGZF_HEADER_SIZE, this->stream.fp);
+		
+		if (n == 0)
+		{
+			this->deflated.resize(in);
+			break;
+		}
+		
+		if (n != BGZF_HEADER_SIZE || head[0] != 0x1f || head[1] != 0x8b || head[2] != 8 || (head[3] & 4) == 0)
+			throw std::runtime_error("Invalid block in BGZF file: " + this->file);
+		
+		const size_t xlen = head[10] | (head[11] << 8);
+		
+		if (BGZF_HEADER_SIZE + xlen > BGZF_BLOCK_SIZE ||
+			fread(head + BGZF_HEADER_SIZE, sizeof(char), xlen, this->stream.fp) != xlen)
+			throw std::runtime_error("Invalid block in BGZF file: " + this->file);
+		
+		const size_t bsize = bgzf_bsize(head + BGZF_HEADER_SIZE, xlen);
+		
+		if (bsize < BGZF_HEADER_SIZE + xlen + BGZF_FOOTER_SIZE || bsize > BGZF_BLOCK_SIZE)
+			throw std::runtime_error("Invalid block in BGZF file: " + this->file);
+		
+		// read remaining block
+		const size_t rest = bsize - BGZF_HEADER_SIZE - xlen;
+		
+		if (fread(head + BGZF_HEADER_SIZE + xlen, sizeof(char), rest, this->stream.fp) != rest)
+			throw std::runtime_error("Unexpected end of BGZF file: " + this->file);
+		
+		const unsigned char * foot = head + bsize - BGZF_FOOTER_SIZE;
+		
+		Block b;
+		b.in       = in + BGZF_HEADER_SIZE + xlen;
+		b.in_size  = rest - BGZF_FOOTER_SIZE;
+		b.out      = out;
+		b.out_size = foot[4] | (foot[5] << 8) | (foot[6] << 16) | ((size_t)foot[7] << 24);
+		b.crc      = foot[0] | (foot[1] << 8) | (foot[2] << 16) | ((uLong)foot[3] << 24);
+		
+		if (b.out_size > BGZF_BLOCK_SIZE)
+			throw std::runtime_error("Invalid block in BGZF file: " + this->file);
+		
+		this->block.push_back(b);
+		this->deflated.resize(in + bsize);
+		this->bgzf_pos += bsize;
+		
+		out += b.out_size;
+	}
+	
+	if (this->block.empty())
+	{
+		// end of file within range
+		if (! this->range.empty())
+		{
+			this->range_i = this->range.size();
+		}
+		
+		this->inflated.clear();
+		return false;
+	}
+	
+	this->inflated.resize(out);
+	
+	// inflate blocks independently
+	std::atomic<size_t> next(0);
+	std::atomic<bool> good(true);
+	
+	auto work = [this, &next, &good]()
+	{
+		z_stream z;
+		memset(&z, 0, sizeof(z_stream));
+		
+		if (inflateInit2(&z, -15) != Z_OK) // raw deflate
+		{
+			good = false;
+			return;
+		}
+		
+		const size_t n = this->block.size();
+		
+		for (size_t i = next++; i < n && good; i = next++)
+		{
+			const Block & b = this->block[i];
+			
+			if (b.out_size == 0) // empty, e.g. end-of-file marker
+				continue;
+			
+			inflateReset(&z);
+			z.next_in   = reinterpret_cast<Bytef *>(&this->deflated[b.in]);
+			z.avail_in  = (uInt)b.in_size;
+			z.next_out  = reinterpret_cast<Bytef *>(&this->inflated[b.out]);
+			z.avail_out = (uInt)b.out_size;
+			
+			if (::inflate(&z, Z_FINISH) != Z_STREAM_END || z.total_out != b.out_size ||
+				crc32(0, z.next_out - b.out_size, (uInt)b.out_size) != b.crc)
+			{
+				good = false;
+			}
+		}
+		
+		inflateEnd(&z);
+	};
+	
+	const int t_size = (int)std::min((size_t)this->n_thread, this->block.size());
+	
+	std::vector<std::thread> t;
+	
+	for (int i = 0; i < t_size - 1; ++i)
+	{
+		t.push_back(std::thread(work));
+	}
+	
+	work(); // on this thread
+	
+	for (int i = 0; i < t_size - 1; ++i)
+	{
+		t[i].join();
+	}
+	
+	if (! good)
+		throw std::runtime_error("Cannot inflate block in BGZF file: " + this->file);
+	
+	if (! this->range.empty())
+	{
+		// skip to first record of range
+		this->inflated_pos = std::min(skip, this->inflated.size());
+		
+		// complete last line of range, then proceed to next range
+		if (tail)
+		{
+			const char * brk = static_cast<const char *>(memchr(&this->inflated[0], '\n', this->inflated.size()));
+			
+			if (brk != NULL)
+			{
+				this->inflated.resize(brk - &this->inflated[0] + 1);
+				
+				++this->range_i;
+				this->range_seek = true;
+			}
+		}
+		
+		if (this->inflated_pos < this->inflated.size())
+		{
+			this->range_back = this->inflated.back();
+		}
+	}
+	
+	return true;
+}
+
+int StreamLine::fill(char * ptr, const int size)
+{
+	if (this->bgzf)
+	{
+		int n = 0;
+		
+		// read from inflated blocks, in order
+		while (n < size)
+		{
+			if (this->inflated_pos == this->inflated.size())
+			{
+				if (! this->inflate())
+					break;
+				
+				continue;
+			}
+			
+			const size_t copy = std::min((size_t)(size - n), this->inflated.size() - this->inflated_pos);
+			
+			memcpy(ptr + n, &this->inflated[this->inflated_pos], copy);
+			
+			this->inflated_pos += copy;
+			n += (int)copy;
+		}
+		
+		return n;
+	}
+	
+	if (this->cmpr)
+	{
+		// read from gzip
+		return gzread(this->stream.gz, ptr, size);
+	}
+	
+	// read from file
+	return (int)fread(ptr, sizeof(char), size, this->stream.fp);
+}
+
 bool StreamLine::read()
 {
 	if (this->eof)
@@ -87,16 +384,7 @@ bool StreamLine::read()
 	this->bufptr = &this->buffer[size];
 	*this->bufptr = '\0';
 	
-	if (this->cmpr)
-	{
-		// read from gzip
-		n = gzread(this->stream.gz, this->bufptr, this->length);
-	}
-	else
-	{
-		// read from file
-		n = (int)fread(this->bufptr, sizeof(this->buffer[0]), this->length, this->stream.fp);
-	}
+	n = this->fill(this->bufptr, this->length);
 	
 	// handle end of file
 	if (n < 1)
@@ -193,12 +481,17 @@ void StreamLine::open(const std::string & filename)
 	this->gzip();
 	
 	// open file
-	if (this->cmpr)
+	if (this->bgzf)
+	{
+		if ((this->stream.fp = fopen(this->file.c_str(), "rb")) == NULL)
+			throw std::runtime_error("Cannot open compressed file: " + this->file);
+	}
+	else if (this->cmpr)
 	{
 		if ((this->stream.gz = gzopen(this->file.c_str(), "rb")) == NULL)
 			throw std::runtime_error("Cannot open compressed file: " + this->file);
 	}
-	else
+	else if (! this->map_file())
 	{
 		if ((this->stream.fp = fopen(this->file.c_str(), "r")) == NULL)
 			throw std::runtime_error("Cannot open file: " + this->file);
@@ -211,7 +504,11 @@ void StreamLine::close()
 {
 	if (this->opened)
 	{
-		if (this->cmpr)
+		if (this->mapped)
+			munmap(this->map, this->map_size);
+		else if (this->bgzf)
+			fclose(this->stream.fp);
+		else if (this->cmpr)
 			gzclose(this->stream.gz);
 		else
 			fclose(this->stream.fp);
@@ -223,6 +520,18 @@ void StreamLine::close()
 	this->cache.clear();
 	this->use = this->cache.cend();
 	this->end = this->cache.cend();
+	
+	this->block.clear();
+	this->deflated.clear();
+	this->inflated.clear();
+	this->inflated_pos = 0;
+	
+	this->mapped = false;
+	this->map = NULL;
+	this->map_size = 0;
+	this->newline.clear();
+	this->newline_i = 0;
+	this->indexed = false;
 }
 
 void StreamLine::reset()
@@ -234,7 +543,21 @@ void StreamLine::reset()
 	}
 #endif
 	
-	if (this->cmpr)
+	if (this->mapped)
+	{
+		this->newline_i = 0;
+	}
+	else if (this->bgzf)
+	{
+		if (fseek(this->stream.fp, 0, SEEK_SET) != 0)
+			throw std::runtime_error("Exception while handling compressed file: " + this->file);
+		
+		this->inflated.clear();
+		this->inflated_pos = 0;
+		this->bgzf_pos = 0;
+		this->range.clear();
+	}
+	else if (this->cmpr)
 	{
 		if (gzrewind(this->stream.gz) != 0)
 			throw std::runtime_error("Exception while handling compressed file: " + this->file);
@@ -249,6 +572,11 @@ void StreamLine::reset()
 	this->cache = std::vector<char*>(1);
 	this->use = this->cache.cbegin();
 	this->end = this->cache.cend();
+	
+	// discard overhang of previous reads
+	this->bufptr = &this->buffer[0];
+	*this->bufptr = '\0';
+	this->eof = false;
 }
 
 bool StreamLine::next()
@@ -260,6 +588,42 @@ bool StreamLine::next()
 	}
 #endif
 	
+	// view into mapped file
+	if (this->mapped)
+	{
+		// extend prefix of index by next newline
+		if (this->newline_i == this->newline.size() && ! this->indexed)
+		{
+			const size_t pos = this->newline.empty() ? 0: this->newline.back() + 1;
+			const char * brk = static_cast<const char *>(memchr(this->map + pos, '\n', this->map_size - pos));
+			
+			if (brk != NULL)
+			{
+				this->newline.push_back(brk - this->map);
+			}
+			else
+			{
+				if (pos < this->map_size) // last line without newline ends at end of file
+					this->newline.push_back(this->map_size);
+				
+				this->indexed = true;
+			}
+		}
+		
+		if (this->newline_i == this->newline.size())
+		{
+			return false;
+		}
+		
+		this->cache.assign(1, this->map_line(this->newline_i++));
+		this->use = this->cache.cbegin();
+		this->end = this->cache.cend();
+		
+		++this->n_line;
+		
+		return true;
+	}
+	
 	++this->use;
 	
 	if (this->use == this->end)
@@ -293,96 +657,698 @@ bool StreamLine::next()
 	return true;
 }
 
-
-
-//******************************************************************************
-// Split line into tokens
-//******************************************************************************
-StreamSplit::StreamSplit(char * _use, const char * _del)
-: del(strlen(_del) + 1)
-, ptr(_use)
-, beg(_use)
-, end(NULL)
-, n(0)
-{
-	strcpy(&this->del[0], _del);
-}
-
-StreamSplit::StreamSplit(std::string & _use, const char * _del)
-: del(strlen(_del) + 1)
-, ptr(&_use[0])
-, beg(&_use[0])
-, end(NULL)
-, n(0)
-{
-	strcpy(&this->del[0], _del);
-}
-
-bool StreamSplit::next()
+bool StreamLine::chunk(std::vector<char> & data)
 {
-	// skip leading delimiters
-	if (this->beg != NULL)
+#ifdef DEBUG_STREAM
+	if (! this->opened)
 	{
-		while (*this->beg != '\0' && strchr(&this->del[0], *this->beg) != NULL)
-		{
-			++this->beg;
-		}
-		
-		if (*this->beg == '\0')
-		{
-			return false;
-		}
+		throw std::runtime_error("Read stream not open");
 	}
+#endif
 	
-	if (this->beg == NULL)
+	data.clear();
+	
+	// hand over lines cached by line-wise reading
+	if (this->use != this->end)
 	{
-		return false;
+		for (std::vector<char*>::const_iterator it = this->use + 1; it < this->end; ++it)
+		{
+			data.insert(data.end(), *it, *it + strlen(*it));
+			data.push_back('\n');
+		}
+		
+		this->cache.clear();
+		this->use = this->cache.cend();
+		this->end = this->cache.cend();
 	}
 	
-	this->ptr = this->beg; // point to begin
-	
-	this->end = strpbrk(this->beg, &this->del[0]); // detect delimiter
+	// hand over incomplete line of previous read
+	const size_t size = strlen(this->bufptr);
+	data.insert(data.end(), this->bufptr, this->bufptr + size);
+	this->bufptr = &this->buffer[0];
+	*this->bufptr = '\0';
 	
-	if (this->end != NULL)
+	// read until chunk ends with complete line
+	while (! this->eof)
 	{
-		*this->end = '\0'; // terminate token
+		const size_t offset = data.size();
 		
-		this->beg = this->end + 1; // set begin
+		data.resize(offset + this->length);
+		
+		const int n = this->fill(&data[offset], this->length);
+		
+		if (n < 1)
+		{
+			data.resize(offset);
+			this->eof = true;
+			break;
+		}
+		
+		data.resize(offset + n);
+		
+		// detect last newline
+		size_t last = data.size();
+		while (last > offset && data[last - 1] != '\n')
+			--last;
+		
+		if (last > offset)
+		{
+			// keep incomplete line for next chunk
+			const size_t rest = data.size() - last;
+			
+			if (rest > 0)
+				memcpy(this->bufptr, &data[last], rest);
+			
+			*(this->bufptr + rest) = '\0';
+			
+			data.resize(last);
+			break;
+		}
 	}
-	else
+	
+	if (data.empty())
 	{
-		this->beg = NULL; // indicate exit
+		return false;
 	}
 	
-	++this->n; // count token
+	data.push_back('\0'); // terminate chunk
 	
 	return true;
 }
 
-StreamSplit::operator char * () const
-{
-	return this->ptr;
-}
-
-bool StreamSplit::convert(int & i)
+bool StreamLine::chunk(StreamChunk & chunk)
 {
-	char * p = this->ptr;
+	if (! this->mapped)
+	{
+		return this->chunk(chunk.data); // split by receiver
+	}
 	
-	if (*p == '\0')
-		return false;
+	chunk.data.clear();
+	chunk.line.clear();
 	
-	// accept leading minus
-	if (*p == '-')
+	// index on first chunk, after number of threads is set
+	if (! this->indexed)
+		this->map_index();
+	
+	size_t bytes = 0;
+	
+	// hand out views of lines following the current line
+	while (this->newline_i < this->newline.size() && bytes < (size_t)this->length)
 	{
-		++p;
+		char * ptr = this->map_line(this->newline_i);
 		
-		if (*p == '\0')
-			return false;
+		chunk.line.push_back(ptr);
+		chunk.end = this->map + this->newline[this->newline_i];
+		
+		bytes += chunk.end - ptr + 1;
+		++this->newline_i;
 	}
 	
-	while (*p != '\0')
-	{
-		if (*p < '0' || *p > '9')
+	return (! chunk.line.empty());
+}
+
+bool StreamLine::map_file()
+{
+	struct stat st;
+	
+	const int fd = ::open(this->file.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw std::runtime_error("Cannot open file: " + this->file);
+	
+	// regular, non-empty files only
+	if (fstat(fd, &st) != 0 || ! S_ISREG(st.st_mode) || st.st_size == 0)
+	{
+		::close(fd);
+		return false;
+	}
+	
+	const size_t size = (size_t)st.st_size;
+	const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	
+	// private mapping, lines are terminated in place
+	void * ptr = ::mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	
+	if (ptr == MAP_FAILED)
+		return false;
+	
+	char * map = static_cast<char *>(ptr);
+	
+	// last line without newline is terminated in slack of last page, unless there is none
+	if (map[size - 1] != '\n' && size % page == 0)
+	{
+		munmap(ptr, size);
+		return false;
+	}
+	
+	madvise(ptr, size, MADV_SEQUENTIAL);
+	
+	this->map = map;
+	this->map_size = size;
+	this->mapped = true;
+	
+	return true;
+}
+
+void StreamLine::map_index()
+{
+	const size_t pos = this->newline.empty() ? 0: this->newline.back() + 1; // end of indexed prefix
+	const size_t size = this->map_size - pos;
+	const size_t n = std::max((size_t)1, std::min((size_t)this->n_thread, size / MAP_INDEX_SIZE));
+	const size_t step = size / n;
+	
+	std::vector< std::vector<size_t> > found(n);
+	
+	// find newlines in segment of file
+	auto work = [this, &found, pos, n, step](const size_t i)
+	{
+		const char * beg = this->map + pos + i * step;
+		const char * end = (i + 1 == n) ? this->map + this->map_size: beg + step;
+		const char * brk;
+		
+		while ((brk = static_cast<const char *>(memchr(beg, '\n', end - beg))) != NULL)
+		{
+			found[i].push_back(brk - this->map);
+			beg = brk + 1;
+		}
+	};
+	
+	std::vector<std::thread> t;
+	
+	for (size_t i = 1; i < n; ++i)
+	{
+		t.push_back(std::thread(work, i));
+	}
+	
+	work(0); // on this thread
+	
+	for (size_t i = 1; i < n; ++i)
+	{
+		t[i - 1].join();
+	}
+	
+	// merge segments in order
+	size_t total = 0;
+	
+	for (size_t i = 0; i < n; ++i)
+		total += found[i].size();
+	
+	this->newline.reserve(this->newline.size() + total + 1);
+	
+	for (size_t i = 0; i < n; ++i)
+		this->newline.insert(this->newline.end(), found[i].begin(), found[i].end());
+	
+	// last line without newline ends at end of file
+	if ((this->newline.empty() ? 0: this->newline.back() + 1) < this->map_size)
+		this->newline.push_back(this->map_size);
+	
+	this->indexed = true;
+}
+
+char * StreamLine::map_line(const size_t i)
+{
+	char * ptr = this->map + ((i == 0) ? 0: this->newline[i - 1] + 1);
+	
+	this->map[this->newline[i]] = '\0'; // replace newline
+	
+	return ptr;
+}
+
+void StreamLine::threads(const int n)
+{
+	this->n_thread = std::max(1, n);
+}
+
+void StreamLine::seek(const std::vector< std::pair<uint64_t, uint64_t> > & ranges)
+{
+#ifdef DEBUG_STREAM
+	if (! this->opened)
+	{
+		throw std::runtime_error("Read stream not open");
+	}
+#endif
+	
+	if (! this->bgzf)
+	{
+		throw std::runtime_error("Cannot seek in file not compressed as BGZF: " + this->file);
+	}
+	
+	this->range = ranges;
+	this->range_i = 0;
+	this->range_seek = true;
+	
+	// end of file if no range given
+	if (this->range.empty())
+	{
+		this->range.push_back(std::make_pair(0, 0));
+		this->range_i = 1;
+	}
+	
+	// discard lines & overhang of previous reads
+	this->n_line = 0;
+	this->cache = std::vector<char*>(1);
+	this->use = this->cache.cbegin();
+	this->end = this->cache.cend();
+	
+	this->bufptr = &this->buffer[0];
+	*this->bufptr = '\0';
+	this->eof = false;
+	
+	this->inflated.clear();
+	this->inflated_pos = 0;
+}
+
+
+
+//******************************************************************************
+// Tabix/CSI index of BGZF file
+//******************************************************************************
+
+#define TBI_MIN_SHIFT 14 // fixed binning scheme of tabix
+#define TBI_DEPTH     5
+
+// read little-endian integers from index file
+static void index_read(gzFile gz, void * ptr, const size_t size, const std::string & file)
+{
+	if (gzread(gz, ptr, (unsigned)size) != (int)size)
+		throw std::runtime_error("Unexpected end of index file: " + file);
+}
+
+static uint32_t index_u32(gzFile gz, const std::string & file)
+{
+	unsigned char b[4];
+	index_read(gz, b, 4, file);
+	return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+static uint64_t index_u64(gzFile gz, const std::string & file)
+{
+	const uint64_t lo = index_u32(gz, file);
+	const uint64_t hi = index_u32(gz, file);
+	return lo | (hi << 32);
+}
+
+static int32_t index_i32(gzFile gz, const std::string & file)
+{
+	return (int32_t)index_u32(gz, file);
+}
+
+StreamIndex::StreamIndex()
+: min_shift(TBI_MIN_SHIFT)
+, depth(TBI_DEPTH)
+, csi(false)
+{}
+
+StreamIndex::StreamIndex(const std::string & filename)
+: StreamIndex()
+{
+	this->load(filename);
+}
+
+void StreamIndex::names(const char * ptr, const size_t size)
+{
+	const char * end = ptr + size;
+	
+	// null-terminated names, in order of references
+	while (ptr < end)
+	{
+		const size_t n = strnlen(ptr, end - ptr);
+		const size_t i = this->name.size();
+		this->name[std::string(ptr, n)] = i;
+		ptr += n + 1;
+	}
+}
+
+void StreamIndex::load(const std::string & filename)
+{
+	char magic[4];
+	
+	this->file = filename;
+	this->name.clear();
+	this->reference.clear();
+	
+	gzFile gz = gzopen(filename.c_str(), "rb");
+	if (gz == NULL)
+		throw std::runtime_error("Cannot open index file: " + filename);
+	
+	try
+	{
+		index_read(gz, magic, 4, filename);
+		
+		if (memcmp(magic, "TBI\1", 4) == 0)
+		{
+			this->csi = false;
+			this->min_shift = TBI_MIN_SHIFT;
+			this->depth = TBI_DEPTH;
+			
+			const int32_t n_ref = index_i32(gz, filename);
+			
+			// format, column indices, meta char, skipped lines
+			for (int i = 0; i < 6; ++i)
+				index_i32(gz, filename);
+			
+			const int32_t l_nm = index_i32(gz, filename);
+			
+			if (n_ref < 0 || l_nm < 0)
+				throw std::runtime_error("Invalid index file: " + filename);
+			
+			std::vector<char> nm(l_nm + 1, '\0');
+			index_read(gz, &nm[0], l_nm, filename);
+			this->names(&nm[0], l_nm);
+			
+			this->reference.resize(n_ref);
+		}
+		else if (memcmp(magic, "CSI\1", 4) == 0)
+		{
+			this->csi = true;
+			this->min_shift = index_i32(gz, filename);
+			this->depth = index_i32(gz, filename);
+			
+			const int32_t l_aux = index_i32(gz, filename);
+			
+			if (this->min_shift < 1 || this->depth < 0 || l_aux < 0)
+				throw std::runtime_error("Invalid index file: " + filename);
+			
+			std::vector<char> aux(l_aux + 1, '\0');
+			index_read(gz, &aux[0], l_aux, filename);
+			
+			// sequence names in tabix header of auxiliary data
+			if (l_aux >= 28)
+			{
+				const unsigned char * b = reinterpret_cast<const unsigned char *>(&aux[24]);
+				const size_t l_nm = b[0] | (b[1] << 8) | (b[2] << 16) | ((size_t)b[3] << 24);
+				
+				if (28 + l_nm <= (size_t)l_aux)
+					this->names(&aux[28], l_nm);
+			}
+			
+			const int32_t n_ref = index_i32(gz, filename);
+			
+			if (n_ref < 0)
+				throw std::runtime_error("Invalid index file: " + filename);
+			
+			this->reference.resize(n_ref);
+		}
+		else
+		{
+			throw std::runtime_error("Unknown index file format: " + filename);
+		}
+		
+		// walkabout references
+		for (size_t i = 0; i < this->reference.size(); ++i)
+		{
+			Reference & ref = this->reference[i];
+			
+			const int32_t n_bin = index_i32(gz, filename);
+			
+			for (int32_t j = 0; j < n_bin; ++j)
+			{
+				const uint32_t id = index_u32(gz, filename);
+				
+				Bin & bin = ref.bin[id];
+				bin.loffset = (this->csi) ? index_u64(gz, filename): 0;
+				
+				const int32_t n_chunk = index_i32(gz, filename);
+				
+				for (int32_t k = 0; k < n_chunk; ++k)
+				{
+					const uint64_t beg = index_u64(gz, filename);
+					const uint64_t end = index_u64(gz, filename);
+					bin.chunk.push_back(Chunk(beg, end));
+				}
+			}
+			
+			if (! this->csi)
+			{
+				const int32_t n_intv = index_i32(gz, filename);
+				
+				for (int32_t j = 0; j < n_intv; ++j)
+				{
+					ref.linear.push_back(index_u64(gz, filename));
+				}
+			}
+		}
+	}
+	catch (...)
+	{
+		gzclose(gz);
+		throw;
+	}
+	
+	gzclose(gz);
+	
+	if (this->name.size() != this->reference.size())
+		throw std::runtime_error("Sequence names missing in index file: " + filename);
+}
+
+std::vector<StreamIndex::Chunk> StreamIndex::query(const std::string & seq, const size_t beg, size_t end) const
+{
+	std::vector<Chunk> found;
+	
+	std::unordered_map<std::string, size_t>::const_iterator it = this->name.find(seq);
+	
+	if (it == this->name.end() || end <= beg)
+	{
+		return found;
+	}
+	
+	const Reference & ref = this->reference[it->second];
+	const size_t max = (size_t)1 << (this->min_shift + this->depth * 3); // max position covered by bins
+	
+	if (beg >= max)
+	{
+		return found;
+	}
+	
+	end = std::min(end, max);
+	
+	// lowest virtual offset of records overlapping region
+	uint64_t min_off = 0;
+	
+	if (this->csi)
+	{
+		// walk up from smallest bin containing begin
+		int64_t id = (((int64_t)1 << (this->depth * 3)) - 1) / 7 + (int64_t)(beg >> this->min_shift);
+		
+		while (id >= 0)
+		{
+			std::unordered_map<uint32_t, Bin>::const_iterator bt = ref.bin.find((uint32_t)id);
+			
+			if (bt != ref.bin.end())
+			{
+				min_off = bt->second.loffset;
+				break;
+			}
+			
+			id = (id == 0) ? -1: (id - 1) >> 3;
+		}
+	}
+	else if (! ref.linear.empty())
+	{
+		const size_t i = beg >> this->min_shift;
+		min_off = ref.linear[std::min(i, ref.linear.size() - 1)];
+	}
+	
+	// collect chunks of bins overlapping region
+	int shift = this->min_shift + this->depth * 3;
+	int64_t first = 0;
+	
+	for (int level = 0; level <= this->depth; ++level, shift -= 3)
+	{
+		const int64_t b = first + (int64_t)(beg >> shift);
+		const int64_t e = first + (int64_t)((end - 1) >> shift);
+		
+		for (int64_t id = b; id <= e; ++id)
+		{
+			std::unordered_map<uint32_t, Bin>::const_iterator bt = ref.bin.find((uint32_t)id);
+			
+			if (bt == ref.bin.end())
+				continue;
+			
+			for (const Chunk & chunk : bt->second.chunk)
+			{
+				if (chunk.second > min_off)
+					found.push_back(chunk);
+			}
+		}
+		
+		first += (int64_t)1 << (level * 3);
+	}
+	
+	// merge chunks sharing blocks
+	std::sort(found.begin(), found.end());
+	
+	std::vector<Chunk> merged;
+	
+	for (const Chunk & chunk : found)
+	{
+		if (! merged.empty() && (chunk.first >> 16) <= (merged.back().second >> 16))
+		{
+			merged.back().second = std::max(merged.back().second, chunk.second);
+			continue;
+		}
+		
+		merged.push_back(chunk);
+	}
+	
+	return merged;
+}
+
+
+
+//******************************************************************************
+// Chunk of lines passed between threads
+//******************************************************************************
+
+StreamChunk::StreamChunk()
+: end(NULL)
+, first(0)
+{}
+
+StreamChunk::~StreamChunk()
+{
+	// drop private copies of pages written while terminating lines in mapped file,
+	// except pages shared with neighbouring chunks
+	if (this->data.empty() && ! this->line.empty())
+	{
+		const uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+		const uintptr_t beg = ((uintptr_t)this->line.front() + page - 1) / page * page;
+		const uintptr_t end = ((uintptr_t)this->end + 1) / page * page;
+		
+		if (beg < end)
+			madvise((void *)beg, end - beg, MADV_DONTNEED);
+	}
+}
+
+void StreamChunk::split()
+{
+	// lines are views into mapped file, terminated by reader
+	if (this->data.empty())
+		return;
+	
+	this->line.clear();
+	
+	char * ptr = &this->data[0];
+	char * end = ptr + this->data.size() - 1; // terminating null
+	char * brk;
+	
+	this->end = end;
+	
+	while (ptr < end)
+	{
+		this->line.push_back(ptr);
+		
+		brk = static_cast<char*>(memchr(ptr, '\n', end - ptr)); // detect newline
+		
+		if (brk == NULL)
+			break;
+		
+		*brk = '\0'; // replace newline
+		ptr = brk + 1;
+	}
+}
+
+
+
+//******************************************************************************
+// Split line into tokens
+//******************************************************************************
+StreamSplit::StreamSplit(char * _use, const char * _del)
+: del(strlen(_del) + 1)
+, ptr(_use)
+, beg(_use)
+, end(NULL)
+, n(0)
+{
+	strcpy(&this->del[0], _del);
+}
+
+StreamSplit::StreamSplit(std::string & _use, const char * _del)
+: del(strlen(_del) + 1)
+, ptr(&_use[0])
+, beg(&_use[0])
+, end(NULL)
+, n(0)
+{
+	strcpy(&this->del[0], _del);
+}
+
+bool StreamSplit::next()
+{
+	// skip leading delimiters
+	if (this->beg != NULL)
+	{
+		while (*this->beg != '\0' && strchr(&this->del[0], *this->beg) != NULL)
+		{
+			++this->beg;
+		}
+		
+		if (*this->beg == '\0')
+		{
+			return false;
+		}
+	}
+	
+	if (this->beg == NULL)
+	{
+		return false;
+	}
+	
+	this->ptr = this->beg; // point to begin
+	
+	this->end = strpbrk(this->beg, &this->del[0]); // detect delimiter
+	
+	if (this->end != NULL)
+	{
+		*this->end = '\0'; // terminate token
+		
+		this->beg = this->end + 1; // set begin
+	}
+	else
+	{
+		this->beg = NULL; // indicate exit
+	}
+	
+	++this->n; // count token
+	
+	return true;
+}
+
+char * StreamSplit::remain() const
+{
+	return this->beg;
+}
+
+void StreamSplit::forward(char * ptr, const size_t tokens)
+{
+	this->beg = ptr;
+	this->n += tokens;
+}
+
+StreamSplit::operator char * () const
+{
+	return this->ptr;
+}
+
+bool StreamSplit::convert(int & i)
+{
+	char * p = this->ptr;
+	
+	if (*p == '\0')
+		return false;
+	
+	// accept leading minus
+	if (*p == '-')
+	{
+		++p;
+		
+		if (*p == '\0')
+			return false;
+	}
+	
+	while (*p != '\0')
+	{
+		if (*p < '0' || *p > '9')
 			return false;
 		
 		++p;
@@ -468,24 +1434,29 @@ const char * StreamSplit::def = " \t"; // whitespace
 StreamOut::StreamOut()
 : fp(nullptr)
 , good(false)
+, gzip(false)
+, buffer_pos(0)
 {}
 
 StreamOut::StreamOut(const std::string & filename)
-: good(true)
-, name(filename)
+: fp(nullptr)
+, good(false)
+, gzip(false)
+, buffer_pos(0)
 {
-	if ((this->fp = fopen(filename.c_str(), "w")) == NULL)
-	{
-		throw std::runtime_error("Cannot create output file: " + this->name);
-	}
+	this->open(filename);
 }
 
 StreamOut::~StreamOut()
 {
-	this->close();
+	try
+	{
+		this->close();
+	}
+	catch (...) {} // errors are reported when closed explicitly
 }
 
-void StreamOut::open(const std::string & filename)
+void StreamOut::open(const std::string & filename, const bool compress)
 {
 #ifdef DEBUG_STREAM
 	if (this->good)
@@ -494,22 +1465,180 @@ void StreamOut::open(const std::string & filename)
 	}
 #endif
 	
+	this->name = filename;
+	
 	if ((this->fp = fopen(filename.c_str(), "w")) == NULL)
 	{
 		throw std::runtime_error("Cannot create output file: " + this->name);
 	}
 	
-	this->name = filename;
 	this->good = true;
+	this->gzip = compress;
+	this->buffer.resize(STREAM_OUT_BUFFER);
+	this->buffer_pos = 0;
+	this->ex_write = nullptr;
+	
+	if (this->gzip)
+	{
+		this->queue.reset(new StreamQueue< std::vector<char> >(STREAM_OUT_QUEUE));
+		this->writer = std::thread(&StreamOut::deflate, this);
+	}
 }
 
 void StreamOut::close()
 {
-	if (this->good)
-		fclose(this->fp);
+	if (! this->good)
+		return;
+	
+	this->good = false; // close only once
+	
+	try
+	{
+		this->flush();
+	}
+	catch (...)
+	{
+		if (! this->ex_write)
+			this->ex_write = std::current_exception();
+	}
+	
+	if (this->gzip)
+	{
+		this->queue->close();
+		this->writer.join();
+		this->queue.reset();
+	}
+	
+	if (fclose(this->fp) != 0 && ! this->ex_write)
+	{
+		this->ex_write = std::make_exception_ptr(std::runtime_error("Cannot write to output file: " + this->name));
+	}
+	
+	this->fp = nullptr;
+	
+	std::vector<char>().swap(this->buffer);
+	
+	if (this->ex_write)
+		std::rethrow_exception(this->ex_write);
+}
+
+void StreamOut::flush()
+{
+	if (this->buffer_pos == 0)
+		return;
+	
+	if (this->gzip)
+	{
+		std::vector<char> full(STREAM_OUT_BUFFER);
+		
+		full.swap(this->buffer);
+		full.resize(this->buffer_pos);
+		
+		this->buffer_pos = 0;
+		this->queue->push(std::move(full));
+	}
+	else
+	{
+		const size_t n = this->buffer_pos;
+		
+		this->buffer_pos = 0;
+		
+		if (fwrite(&this->buffer[0], 1, n, this->fp) != n)
+		{
+			throw std::runtime_error("Cannot write to output file: " + this->name);
+		}
+	}
 }
 
-StreamOut::operator FILE * () const
+void StreamOut::deflate()
+{
+	z_stream z;
+	std::vector<unsigned char> out(STREAM_OUT_BUFFER);
+	std::vector<char> in;
+	bool good = true;
+	bool init = true; // flag that compressor was initialised
+	
+	z.zalloc = Z_NULL;
+	z.zfree  = Z_NULL;
+	z.opaque = Z_NULL;
+	
+	if (deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) // gzip wrapper
+	{
+		init = false;
+		this->ex_write = std::make_exception_ptr(std::runtime_error("Cannot compress output file: " + this->name));
+		good = false;
+	}
+	
+	// compress input, write output when buffer is full
+	auto compress = [this, &z, &out](const int flush)
+	{
+		int status;
+		
+		do
+		{
+			z.next_out  = &out[0];
+			z.avail_out = static_cast<uInt>(out.size());
+			
+			status = ::deflate(&z, flush);
+			
+			if (status == Z_STREAM_ERROR)
+			{
+				throw std::runtime_error("Cannot compress output file: " + this->name);
+			}
+			
+			const size_t n = out.size() - z.avail_out;
+			
+			if (fwrite(&out[0], 1, n, this->fp) != n)
+			{
+				throw std::runtime_error("Cannot write to output file: " + this->name);
+			}
+		}
+		while (z.avail_out == 0 || (flush == Z_FINISH && status != Z_STREAM_END));
+	};
+	
+	// keep emptying queue after error to not block writing thread
+	while (this->queue->pop(in))
+	{
+		if (! good)
+			continue;
+		
+		try
+		{
+			z.next_in  = reinterpret_cast<Bytef *>(&in[0]);
+			z.avail_in = static_cast<uInt>(in.size());
+			
+			compress(Z_NO_FLUSH);
+		}
+		catch (...)
+		{
+			this->ex_write = std::current_exception();
+			good = false;
+		}
+	}
+	
+	if (good)
+	{
+		try
+		{
+			z.next_in  = Z_NULL;
+			z.avail_in = 0;
+			
+			compress(Z_FINISH);
+		}
+		catch (...)
+		{
+			this->ex_write = std::current_exception();
+		}
+	}
+	
+	// release compressor, also after error
+	if (init)
+	{
+		deflateEnd(&z);
+	}
+}
+
+StreamOut::operator FILE * ()
 {
 #ifdef DEBUG_STREAM
 	if (! this->good)
@@ -518,10 +1647,17 @@ StreamOut::operator FILE * () const
 	}
 #endif
 	
+	if (this->gzip)
+	{
+		throw std::runtime_error("Formatted output is not supported for compressed file: " + this->name);
+	}
+	
+	this->flush(); // keep order of buffered and formatted output
+	
 	return this->fp;
 }
 
-void StreamOut::line(const std::string & str, const char last) const
+void StreamOut::line(const std::string & str, const char last)
 {
 #ifdef DEBUG_STREAM
 	if (! this->good)
@@ -530,12 +1666,239 @@ void StreamOut::line(const std::string & str, const char last) const
 	}
 #endif
 	
-	fprintf(this->fp, "%s%c", str.c_str(), last);
+	this->write(str);
+	this->write(last);
 }
 
 void StreamOut::endl()
 {
-	fputc('\n', this->fp);
+	this->write('\n');
+}
+
+void StreamOut::write(const char c)
+{
+#ifdef DEBUG_STREAM
+	if (! this->good)
+	{
+		throw std::runtime_error("Write stream not open");
+	}
+#endif
+	
+	if (this->buffer_pos == this->buffer.size())
+		this->flush();
+	
+	this->buffer[this->buffer_pos++] = c;
+}
+
+void StreamOut::write(const char * ptr, size_t n)
+{
+#ifdef DEBUG_STREAM
+	if (! this->good)
+	{
+		throw std::runtime_error("Write stream not open");
+	}
+#endif
+	
+	while (n != 0)
+	{
+		if (this->buffer_pos == this->buffer.size())
+			this->flush();
+		
+		const size_t copy = std::min(n, this->buffer.size() - this->buffer_pos);
+		
+		memcpy(&this->buffer[this->buffer_pos], ptr, copy);
+		
+		this->buffer_pos += copy;
+		ptr += copy;
+		n   -= copy;
+	}
+}
+
+void StreamOut::write(const std::string & str)
+{
+	this->write(str.data(), str.size());
+}
+
+void StreamOut::write_uint(uint64_t x)
+{
+	static const char digits[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+	
+	char str[20]; // max 20 digits
+	char * ptr = str + 20;
+	
+	// two digits at once, from last to first
+	while (x >= 100)
+	{
+		const size_t k = (x % 100) * 2;
+		x /= 100;
+		*--ptr = digits[k + 1];
+		*--ptr = digits[k];
+	}
+	
+	if (x < 10)
+	{
+		*--ptr = '0' + static_cast<char>(x);
+	}
+	else
+	{
+		*--ptr = digits[x * 2 + 1];
+		*--ptr = digits[x * 2];
+	}
+	
+	this->write(ptr, str + 20 - ptr);
+}
+
+void StreamOut::write_u32le(const uint32_t x)
+{
+	const char b[4] = { char(x), char(x >> 8), char(x >> 16), char(x >> 24) };
+	
+	this->write(b, 4);
+}
+
+void StreamOut::write_u64le(const uint64_t x)
+{
+	this->write_u32le(static_cast<uint32_t>(x));
+	this->write_u32le(static_cast<uint32_t>(x >> 32));
+}
+
+
+
+//******************************************************************************
+// Binary snapshot file
+//******************************************************************************
+
+uint64_t stream_fingerprint(const std::vector<std::string> & files, const std::string & settings)
+{
+	std::ostringstream str;
+	struct stat st;
+	
+	for (const std::string & file : files)
+	{
+		if (stat(file.c_str(), &st) != 0)
+			throw std::runtime_error("Cannot access file: " + file);
+		
+		str << file << '\0' << st.st_size << '\0' << st.st_mtime << '\0';
+	}
+	
+	str << settings;
+	
+	// FNV-1a
+	const std::string key = str.str();
+	uint64_t hash = 14695981039346656037ULL;
+	
+	for (const char c : key)
+	{
+		hash ^= (unsigned char)c;
+		hash *= 1099511628211ULL;
+	}
+	
+	return hash;
+}
+
+StreamBinaryOut::StreamBinaryOut(const std::string & filename)
+: name(filename)
+, temp(filename + ".tmp")
+{
+	if ((this->fp = fopen(this->temp.c_str(), "wb")) == NULL)
+	{
+		throw std::runtime_error("Cannot create file: " + this->temp);
+	}
+}
+
+StreamBinaryOut::~StreamBinaryOut()
+{
+	// discard incomplete file
+	if (this->fp != NULL)
+	{
+		fclose(this->fp);
+		remove(this->temp.c_str());
+	}
+}
+
+void StreamBinaryOut::put(const std::string & x)
+{
+	this->put<uint64_t>(x.size());
+	
+	if (! x.empty() && fwrite(x.data(), sizeof(char), x.size(), this->fp) != x.size())
+		throw std::runtime_error("Cannot write to file: " + this->temp);
+}
+
+void StreamBinaryOut::close()
+{
+	const bool good = (fclose(this->fp) == 0);
+	this->fp = NULL;
+	
+	if (! good || rename(this->temp.c_str(), this->name.c_str()) != 0)
+	{
+		remove(this->temp.c_str());
+		throw std::runtime_error("Cannot write to file: " + this->name);
+	}
+}
+
+StreamBinaryIn::StreamBinaryIn(const std::string & filename)
+: map(NULL)
+, size(0)
+, pos(0)
+, name(filename)
+{
+	struct stat st;
+	
+	const int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		return;
+	
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+	{
+		void * ptr = ::mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		
+		if (ptr != MAP_FAILED)
+		{
+			madvise(ptr, (size_t)st.st_size, MADV_SEQUENTIAL);
+			
+			this->map = static_cast<char *>(ptr);
+			this->size = (size_t)st.st_size;
+		}
+	}
+	
+	::close(fd);
+}
+
+StreamBinaryIn::~StreamBinaryIn()
+{
+	if (this->map != NULL)
+		munmap(this->map, this->size);
+}
+
+bool StreamBinaryIn::good() const
+{
+	return (this->map != NULL);
+}
+
+void StreamBinaryIn::check(const size_t n) const
+{
+	if (this->map == NULL || n > this->size - this->pos)
+		throw std::runtime_error("Unexpected end of file: " + this->name);
+}
+
+std::string StreamBinaryIn::str()
+{
+	const uint64_t n = this->get<uint64_t>();
+	
+	this->check(n);
+	
+	std::string x(this->map + this->pos, n);
+	this->pos += n;
+	return x;
 }
 
 
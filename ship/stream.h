@@ -13,14 +13,33 @@
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <stdint.h>
 #include <ctype.h>
 #include <zlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <iostream>
 #include <fstream>
 #include <vector>
 #include <string>
 #include <sstream>
+#include <utility>
+#include <unordered_map>
+#include <deque>
+#include <algorithm>
+#include <type_traits>
 #include <stdexcept>
+#include <exception>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+
+struct StreamChunk;
 
 
 //******************************************************************************
@@ -32,10 +51,18 @@ private:
 	
 	union Stream
 	{
-		FILE * fp; // stream for uncompressed, i.e. text file
+		FILE * fp; // stream for uncompressed, i.e. text file, or block compressed file
 		gzFile gz; // stream for compressed, i.e. binary file
 	};
 	
+	// block of BGZF file
+	struct Block
+	{
+		size_t in, in_size;   // compressed data in deflated buffer
+		size_t out, out_size; // inflated data in inflated buffer
+		uLong crc; // checksum of inflated data
+	};
+	
 	Stream      stream; // file/gzip stream
 	bool        opened; // flag that stream was opened
 	size_t      n_line; // line count
@@ -49,10 +76,45 @@ private:
 	
 	std::string file;   // source file
 	bool        cmpr;   // flag that file is gzip compressed
+	bool        bgzf;   // flag that file is block gzip compressed (BGZF)
+	bool        mapped; // flag that uncompressed file is memory-mapped
+	
+	char *              map;      // mapped file
+	size_t              map_size; // size of mapped file
+	std::vector<size_t> newline;   // offsets of newlines in mapped file, prefix until indexed
+	size_t              newline_i; // index of next line in mapped file
+	bool                indexed;   // flag that newlines of whole mapped file are indexed
+	
+	int n_thread; // number of threads inflating BGZF blocks or indexing newlines
+	std::vector<Block> block;    // BGZF blocks of current batch
+	std::vector<char>  deflated; // BGZF blocks read from file
+	std::vector<char>  inflated; // BGZF blocks inflated
+	size_t             inflated_pos; // read position in inflated blocks
+	size_t             bgzf_pos; // file offset of next BGZF block
+	
+	std::vector< std::pair<uint64_t, uint64_t> > range; // virtual offset ranges to read, empty if whole file
+	size_t range_i;    // current range
+	bool   range_seek; // flag that current range was not yet sought
+	char   range_back; // last char inflated in current range
 	
 	// detect gzip compression
 	void gzip();
 	
+	// read & inflate next batch of BGZF blocks
+	bool inflate();
+	
+	// map uncompressed file into memory, return false if not possible
+	bool map_file();
+	
+	// index newlines of mapped file following the indexed prefix
+	void map_index();
+	
+	// return view of line in mapped file, terminated in place
+	char * map_line(const size_t);
+	
+	// read raw bytes from file
+	int fill(char *, const int);
+	
 	// read line into buffer
 	bool read();
 	
@@ -82,6 +144,16 @@ public:
 	// forward to next line
 	bool next();
 	
+	// read chunk of complete lines following the current line
+	bool chunk(std::vector<char> &);
+	bool chunk(StreamChunk &);
+	
+	// set number of threads inflating BGZF blocks or indexing newlines
+	void threads(const int);
+	
+	// restrict reading to ranges of virtual offsets in BGZF file
+	void seek(const std::vector< std::pair<uint64_t, uint64_t> > &);
+	
 	// construct
 	StreamLine();
 	StreamLine(const std::string &);
@@ -96,6 +168,161 @@ public:
 
 
 
+//******************************************************************************
+// Tabix/CSI index of BGZF file
+//******************************************************************************
+class StreamIndex
+{
+private:
+	
+	typedef std::pair<uint64_t, uint64_t> Chunk; // virtual offset range
+	
+	struct Bin
+	{
+		uint64_t           loffset; // lowest virtual offset of records in bin (CSI only)
+		std::vector<Chunk> chunk;   // chunks of records in bin
+	};
+	
+	struct Reference
+	{
+		std::unordered_map<uint32_t, Bin> bin;    // binning index
+		std::vector<uint64_t>             linear; // linear index (TBI only)
+	};
+	
+	int min_shift; // size of smallest bin, as bit shift
+	int depth;     // number of bin levels
+	bool csi;      // flag that index is in CSI format
+	
+	std::unordered_map<std::string, size_t> name; // sequence names
+	std::vector<Reference> reference; // index per sequence
+	
+	std::string file; // index file
+	
+	// parse sequence names
+	void names(const char *, const size_t);
+	
+public:
+	
+	// load index file (.tbi or .csi)
+	void load(const std::string &);
+	
+	// find virtual offset ranges covering region (0-based, end exclusive)
+	std::vector<Chunk> query(const std::string &, const size_t, const size_t) const;
+	
+	// construct
+	StreamIndex();
+	StreamIndex(const std::string &);
+	
+	// do not copy
+	StreamIndex(const StreamIndex &) = delete;
+	StreamIndex & operator = (const StreamIndex &) = delete;
+};
+
+
+
+//******************************************************************************
+// Chunk of lines passed between threads
+//******************************************************************************
+struct StreamChunk
+{
+	std::vector<char>   data;  // raw chunk, terminated lines; empty if lines are views into mapped file
+	std::vector<char*>  line;  // line pointers into data
+	char *              end;   // end of last line
+	size_t              first; // line number of first line
+	
+	// terminate lines and collect line pointers
+	void split();
+	
+	// construct
+	StreamChunk();
+	
+	// destruct, release pages of mapped file
+	~StreamChunk();
+};
+
+
+
+//******************************************************************************
+// Bounded queue between threads
+//******************************************************************************
+template <class Type>
+class StreamQueue
+{
+private:
+	
+	std::deque<Type> queue; // queued elements
+	const size_t capacity;  // max number of queued elements
+	bool closed; // flag that no more elements are pushed
+	
+	std::mutex ex_queue;
+	std::condition_variable cv_push, cv_pop;
+	
+public:
+	
+	// push element, wait while queue is full, return false if closed
+	bool push(Type && x)
+	{
+		std::unique_lock<std::mutex> lock(this->ex_queue);
+		this->cv_push.wait(lock, [this] { return this->queue.size() < this->capacity || this->closed; });
+		
+		if (this->closed)
+			return false;
+		
+		this->queue.push_back(std::move(x));
+		lock.unlock();
+		this->cv_pop.notify_one();
+		return true;
+	}
+	
+	// pop element, wait while queue is empty, return false if closed and empty
+	bool pop(Type & x)
+	{
+		std::unique_lock<std::mutex> lock(this->ex_queue);
+		this->cv_pop.wait(lock, [this] { return !this->queue.empty() || this->closed; });
+		
+		if (this->queue.empty())
+			return false;
+		
+		x = std::move(this->queue.front());
+		this->queue.pop_front();
+		lock.unlock();
+		this->cv_push.notify_one();
+		return true;
+	}
+	
+	// close queue, wake waiting threads
+	void close()
+	{
+		std::unique_lock<std::mutex> lock(this->ex_queue);
+		this->closed = true;
+		lock.unlock();
+		this->cv_pop.notify_all();
+	}
+	
+	// close queue & discard queued elements, wake waiting threads on both ends
+	void cancel()
+	{
+		std::unique_lock<std::mutex> lock(this->ex_queue);
+		this->closed = true;
+		this->queue.clear();
+		lock.unlock();
+		this->cv_pop.notify_all();
+		this->cv_push.notify_all();
+	}
+	
+	// construct
+	StreamQueue(const size_t _capacity)
+	: capacity(_capacity)
+	, closed(false)
+	{}
+	
+	// do not copy
+	StreamQueue(const StreamQueue &) = delete;
+	StreamQueue & operator = (const StreamQueue &) = delete;
+};
+
+
+
 //******************************************************************************
 // Split line into tokens
 //******************************************************************************
@@ -131,6 +358,12 @@ public:
 	// forward to next token, optionally break at seperator
 	bool next();
 	
+	// return pointer to remaining line, NULL if line is exhausted
+	char * remain() const;
+	
+	// skip remaining line up to pointer, counting skipped tokens
+	void forward(char *, const size_t);
+	
 	// construct
 	StreamSplit(char *, const char * = StreamSplit::def);
 	StreamSplit(std::string &, const char * = StreamSplit::def);
@@ -154,22 +387,50 @@ private:
 	
 	FILE * fp; // file pointer
 	bool good; // flag that file was opened
+	bool gzip; // flag that output is compressed
+	
+	std::vector<char> buffer; // formatted output not yet written
+	size_t            buffer_pos; // end of formatted output in buffer
+	
+	std::unique_ptr< StreamQueue< std::vector<char> > > queue; // buffers passed to compressing thread
+	std::thread        writer;   // compresses buffers & writes to file
+	std::exception_ptr ex_write; // error on compressing thread
+	
+	// pass buffer to file or compressing thread
+	void flush();
+	
+	// compress buffers until queue is closed
+	void deflate();
 	
 public:
 	
 	std::string name; // file name
 	
-	// cast file pointer
-	operator FILE * () const;
+	// cast file pointer, for formatted output of uncompressed stream
+	operator FILE * ();
 	
 	// write string as line
-	void line(const std::string &, const char = '\n') const;
+	void line(const std::string &, const char = '\n');
 	
 	// write end of line
 	void endl();
 	
-	// open stream
-	void open(const std::string &);
+	// write into buffer
+	void write(const char);
+	void write(const char *, const size_t);
+	void write(const std::string &);
+	
+	// write unsigned integer as text
+	void write_uint(uint64_t);
+	
+	// write unsigned integer as 4 bytes, little-endian
+	void write_u32le(const uint32_t);
+	
+	// write unsigned integer as 8 bytes, little-endian
+	void write_u64le(const uint64_t);
+	
+	// open stream, optionally gzip compressed
+	void open(const std::string &, const bool = false);
 	
 	// close stream
 	void close();
@@ -186,6 +447,130 @@ public:
 
 
 
+//******************************************************************************
+// Binary snapshot file
+//******************************************************************************
+
+// fingerprint of files (name, size, modification time) and further settings
+uint64_t stream_fingerprint(const std::vector<std::string> &, const std::string &);
+
+//
+// Write binary file, native byte order
+//
+class StreamBinaryOut
+{
+private:
+	
+	FILE * fp;        // file pointer
+	std::string name; // file name
+	std::string temp; // file written until closed
+	
+public:
+	
+	// write value
+	template <class Type>
+	void put(const Type & x)
+	{
+		static_assert(std::is_arithmetic<Type>::value, "Cannot write non-arithmetic type");
+		
+		if (fwrite(&x, sizeof(Type), 1, this->fp) != 1)
+			throw std::runtime_error("Cannot write to file: " + this->temp);
+	}
+	
+	// write array of values, preceded by size
+	template <class Type>
+	void put(const std::vector<Type> & x)
+	{
+		static_assert(std::is_arithmetic<Type>::value, "Cannot write non-arithmetic type");
+		
+		this->put<uint64_t>(x.size());
+		
+		if (! x.empty() && fwrite(&x[0], sizeof(Type), x.size(), this->fp) != x.size())
+			throw std::runtime_error("Cannot write to file: " + this->temp);
+	}
+	
+	// write string, preceded by size
+	void put(const std::string &);
+	
+	// complete file, replacing previous file of same name
+	void close();
+	
+	// construct/destruct
+	StreamBinaryOut(const std::string &);
+	~StreamBinaryOut();
+	
+	// do not copy
+	StreamBinaryOut(const StreamBinaryOut &) = delete;
+	StreamBinaryOut & operator = (const StreamBinaryOut &) = delete;
+};
+
+//
+// Read binary file, memory-mapped
+//
+class StreamBinaryIn
+{
+private:
+	
+	char * map;  // mapped file
+	size_t size; // size of file
+	size_t pos;  // read position
+	std::string name; // file name
+	
+	// check that bytes can be read
+	void check(const size_t) const;
+	
+public:
+	
+	// read value
+	template <class Type>
+	Type get()
+	{
+		static_assert(std::is_arithmetic<Type>::value, "Cannot read non-arithmetic type");
+		
+		Type x;
+		this->check(sizeof(Type));
+		memcpy(&x, this->map + this->pos, sizeof(Type));
+		this->pos += sizeof(Type);
+		return x;
+	}
+	
+	// read array of values, preceded by size
+	template <class Type>
+	void get(std::vector<Type> & x)
+	{
+		static_assert(std::is_arithmetic<Type>::value, "Cannot read non-arithmetic type");
+		
+		const uint64_t n = this->get<uint64_t>();
+		
+		if (n > this->size / sizeof(Type))
+			throw std::runtime_error("Unexpected end of file: " + this->name);
+		
+		this->check(n * sizeof(Type));
+		x.resize(n);
+		
+		if (n > 0)
+			memcpy(&x[0], this->map + this->pos, n * sizeof(Type));
+		
+		this->pos += n * sizeof(Type);
+	}
+	
+	// read string, preceded by size
+	std::string str();
+	
+	// check if file was mapped
+	bool good() const;
+	
+	// construct/destruct
+	StreamBinaryIn(const std::string &);
+	~StreamBinaryIn();
+	
+	// do not copy
+	StreamBinaryIn(const StreamBinaryIn &) = delete;
+	StreamBinaryIn & operator = (const StreamBinaryIn &) = delete;
+};
+
+
+
 //******************************************************************************
 // Redirect log & err streams
 //******************************************************************************
@@ -0,0 +1,84 @@
+//
+//  info_count.cpp
+//  ship
+//
+//  Check of allele counts read from the INFO column, incl. stale counts of a
+//  file subset by samples (AN larger than two haplotypes per sample).
+//
+//  Build & run from ship/:
+//  c++ -std=c++14 -O2 -pthread -I. test/info_count.cpp stream.cpp marker.cpp allele.cpp census.cpp genmap.cpp sample.cpp timer.cpp -lz -o info_count && ./info_count
+//
+
+#include <iostream>
+
+#include "parse.hpp"
+
+
+//
+// parse INFO column of line with given sample size, compare with expected counts
+//
+static bool check(const std::string & info, const std::string & alt, const size_t size, const bool expect_ok, const std::vector<size_t> & expect)
+{
+	const std::string line = "1\t100\trs1\tA\t" + alt + "\t.\tPASS\t" + info + "\tGT\t0|1";
+	
+	std::vector<size_t> count;
+	const bool ok = parse_vcf_info_count(line.c_str(), count, size);
+	
+	if (ok != expect_ok)
+	{
+		std::cerr << "Unexpected result " << ok << " for " << info << " with " << size << " samples" << std::endl;
+		return false;
+	}
+	
+	if (! ok)
+		return true;
+	
+	if (count != expect)
+	{
+		std::cerr << "Unexpected counts for " << info << " with " << size << " samples" << std::endl;
+		return false;
+	}
+	
+	// counts are scaled by haplotypes of sample size, as done by the prefilter
+	try
+	{
+		for (const size_t c : count)
+			Census(c, size * 2);
+	}
+	catch (const std::exception & x)
+	{
+		std::cerr << "Cannot scale counts for " << info << " with " << size << " samples: " << x.what() << std::endl;
+		return false;
+	}
+	
+	return true;
+}
+
+
+int main()
+{
+	size_t n_fail = 0;
+	
+	// counts of all samples
+	n_fail += ! check("AC=3;AN=20", "G", 10, true, { 17, 3 });
+	n_fail += ! check("AN=20;AC=3,2", "G,T", 10, true, { 15, 3, 2 });
+	n_fail += ! check("DP=7;AF=0.25;AN=8", "G", 4, true, { 6, 2 });
+	
+	// fewer alleles called than haplotypes, e.g. missing genotypes
+	n_fail += ! check("AC=1;AN=12", "G", 10, true, { 11, 1 });
+	
+	// stale counts of file subset by samples, fall back to genotypes
+	n_fail += ! check("AC=3;AN=22", "G", 10, false, {});
+	n_fail += ! check("AC=150;AN=5000", "G", 100, false, {});
+	n_fail += ! check("AF=0.01;AN=5000", "G", 100, false, {});
+	n_fail += ! check("AC=2500,2400;AN=5000", "G,T", 100, false, {});
+	
+	// missing or inconsistent counts
+	n_fail += ! check("AC=3", "G", 10, false, {});
+	n_fail += ! check("AC=30;AN=20", "G", 10, false, {});
+	n_fail += ! check("AC=3;AN=20", ".", 10, false, {});
+	
+	std::cout << n_fail << " failed checks" << std::endl;
+	
+	return (n_fail == 0) ? EXIT_SUCCESS: EXIT_FAILURE;
+}
@@ -0,0 +1,264 @@
+//
+//  parse_genotypes.cpp
+//  ship
+//
+//  Cross-check of vectorised genotype decoding in parse_vcf_line against the
+//  scalar parser, on regular and irregular lines, and of samples excluded while
+//  parsing against samples erased after parsing.
+//
+//  Build & run from ship/:
+//  c++ -std=c++14 -O2 -pthread -I. test/parse_genotypes.cpp stream.cpp marker.cpp allele.cpp census.cpp genmap.cpp sample.cpp timer.cpp -lz -o parse_genotypes && ./parse_genotypes
+//
+
+#include <iostream>
+#include <random>
+
+#include "parse.hpp"
+
+
+//
+// scalar parser, decodes each genotype field separately
+//
+static bool parse_scalar(char * line, std::vector<Genotype> & data, const std::vector<size_t> * mask)
+{
+	StreamSplit token(line);
+	int conv;
+	
+	data.clear();
+	
+	while (token.next())
+	{
+		if (token.count() < 10)
+			continue;
+		
+		if (mask != NULL && (*mask)[token.count() - 10] == 0)
+			continue;
+		
+		if (token.size() < 3)
+			return false;
+		
+		Genotype g;
+		
+		if ((token[1] == '|' || token[1] == '/') &&
+			(token[3] == ':' || token[3] == '\0'))
+		{
+			g.h0 = static_cast<int>(token[0] - '0');
+			g.h1 = static_cast<int>(token[2] - '0');
+		}
+		else
+		{
+			StreamSplit sub(token, "|/:");
+			
+			if (! sub.next() || ! sub.convert(conv))
+				return false;
+			g.h0 = conv;
+			
+			if (! sub.next() || ! sub.convert(conv))
+				return false;
+			g.h1 = conv;
+		}
+		
+		data.push_back(g);
+	}
+	
+	return true;
+}
+
+
+//
+// random genotype field, regular or irregular
+//
+static std::string field(std::mt19937 & rng, const int irregular)
+{
+	const char sep = (rng() % 4 == 0) ? '/': '|';
+	
+	// regular single-digit haplotypes
+	if (irregular == 0 || rng() % 100 >= (unsigned)irregular)
+	{
+		return std::string(1, '0' + rng() % 10) + sep + std::string(1, '0' + rng() % 10);
+	}
+	
+	switch (rng() % 5)
+	{
+		case 0: // multi-digit allele
+			return std::to_string(10 + rng() % 5) + sep + std::to_string(rng() % 14);
+		case 1: // unknown allele
+			return (rng() % 2 == 0) ? std::string(".") + sep + ".": std::string("0") + sep + ".";
+		case 2: // additional format field
+			return std::string(1, '0' + rng() % 3) + sep + std::string(1, '0' + rng() % 3) + ":0.5";
+		case 3: // multi-digit allele with additional format field
+			return std::to_string(rng() % 14) + sep + std::to_string(10 + rng() % 5) + ":1.0";
+		default: // digit followed by format field
+			return std::string(1, '0' + rng() % 2) + sep + std::string(1, '0' + rng() % 2) + ":12:3";
+	}
+}
+
+
+//
+// compare both parsers on one line, return false on mismatch
+//
+static bool check(const std::string & text, const size_t n, const std::vector<size_t> * mask, const size_t n_keep)
+{
+	std::vector<char> buf1(text.begin(), text.end());
+	std::vector<char> buf2(text.begin(), text.end());
+	buf1.push_back('\0');
+	buf2.push_back('\0');
+	
+	std::vector<Genotype> expect;
+	const bool ok_scalar = parse_scalar(&buf2[0], expect, mask);
+	
+	MarkerInfo info;
+	MarkerData data(n_keep);
+	std::string comment;
+	
+	const bool ok = parse_vcf_line(&buf1[0], info, data, comment, mask);
+	
+	if (ok != ok_scalar || (ok && expect.size() != n_keep))
+	{
+		std::cerr << "Parse result differs (" << comment << ") with " << n << " samples:\n" << text << std::endl;
+		return false;
+	}
+	
+	if (! ok)
+		return true;
+	
+	for (size_t i = 0; i < n_keep; ++i)
+	{
+		if (data[i] != expect[i])
+		{
+			std::cerr << "Genotype differs at sample " << i << " with " << n << " samples:\n" << text << std::endl;
+			return false;
+		}
+	}
+	
+	if (mask == NULL)
+		return true;
+	
+	// same as parsing all samples & erasing excluded samples afterwards
+	std::vector<char> buf3(text.begin(), text.end());
+	buf3.push_back('\0');
+	
+	MarkerData all(n);
+	
+	if (! parse_vcf_line(&buf3[0], info, all, comment))
+	{
+		std::cerr << "Cannot parse all samples (" << comment << "):\n" << text << std::endl;
+		return false;
+	}
+	
+	for (size_t i = n; i > 0; --i)
+	{
+		if ((*mask)[i - 1] == 0)
+			all.erase(i - 1);
+	}
+	
+	for (size_t i = 0; i < n_keep; ++i)
+	{
+		if (all[i] != data[i])
+		{
+			std::cerr << "Genotype differs from erased samples at sample " << i << " with " << n << " samples:\n" << text << std::endl;
+			return false;
+		}
+	}
+	
+	return true;
+}
+
+
+int main()
+{
+	std::mt19937 rng(1);
+	size_t n_line = 0;
+	size_t n_fail = 0;
+	
+	// direct run decoding, regular input at lengths around 4/16/64-byte boundaries
+	for (size_t n = 0; n <= 70; ++n)
+	{
+		for (size_t stop = 0; stop <= n; ++stop)
+		{
+			std::string text;
+			
+			for (size_t i = 0; i < n; ++i)
+				text += field(rng, 0) + '\t';
+			
+			// irregular field stops decoding
+			if (stop < n)
+				text.replace(4 * stop, 3, "1|.");
+			
+			std::vector<unsigned char> raw(n + 1);
+			const size_t m = parse_vcf_genotypes(text.c_str(), text.c_str() + text.size(), &raw[0], n);
+			
+			++n_line;
+			
+			if (m != stop)
+			{
+				std::cerr << "Decoded " << m << " genotypes, expected " << stop << std::endl;
+				++n_fail;
+				continue;
+			}
+			
+			for (size_t i = 0; i < m; ++i)
+			{
+				const Genotype g(text[4 * i] - '0', text[4 * i + 2] - '0');
+				
+				if (static_cast<Genotype>(Datatype(raw[i])) != g)
+				{
+					std::cerr << "Decoded genotype differs at " << i << std::endl;
+					++n_fail;
+					break;
+				}
+			}
+		}
+	}
+	
+	// full lines, sizes around 16/64-byte boundaries, with & without excluded samples
+	for (size_t n = 1; n <= 140; ++n)
+	{
+		for (const int irregular : { 0, 1, 10, 50 })
+		{
+			for (int rep = 0; rep < 20; ++rep)
+			{
+				const bool gtds = (irregular != 0 && rep % 4 == 0);
+				std::string text = "1\t" + std::to_string(100 + rep) + "\trs1\tA\tG,T\t.\tPASS\t.\t" + (gtds ? "GT:DS": "GT");
+				
+				for (size_t i = 0; i < n; ++i)
+				{
+					text += '\t' + field(rng, irregular);
+					
+					if (gtds)
+						text += ":0.1";
+				}
+				
+				if (! check(text, n, NULL, n))
+					++n_fail;
+				
+				// exclude random runs of samples
+				std::vector<size_t> mask(n, 0);
+				size_t n_keep = 0;
+				
+				for (size_t i = 0; i < n; ++i)
+				{
+					if (rng() % 8 != 0)
+					{
+						mask[i] = 1;
+						++n_keep;
+					}
+				}
+				for (size_t i = n; i > 1; --i)
+				{
+					if (mask[i - 2] != 0 && mask[i - 1] != 0)
+						mask[i - 2] += mask[i - 1];
+				}
+				
+				if (n_keep > 0 && ! check(text, n, &mask, n_keep))
+					++n_fail;
+				
+				n_line += 2;
+			}
+		}
+	}
+	
+	std::cout << n_line << " lines checked, " << n_fail << " mismatches" << std::endl;
+	
+	return (n_fail == 0) ? EXIT_SUCCESS: EXIT_FAILURE;
+}
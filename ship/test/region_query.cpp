@@ -0,0 +1,340 @@
+//
+//  region_query.cpp
+//  ship
+//
+//  Check that reading a region of a BGZF file via its tabix index returns the
+//  same lines as a full scan restricted to that region.
+//
+//  Build & run from ship/:
+//  c++ -std=c++14 -O2 -pthread -I. test/region_query.cpp stream.cpp -lz -o region_query && ./region_query
+//
+
+#include <iostream>
+#include <random>
+#include <map>
+
+#include "stream.h"
+
+
+//
+// record of input line
+//
+struct Record
+{
+	std::string chr;
+	size_t pos, len; // 1-based position, length of reference allele
+};
+
+
+//
+// split CHROM, POS & REF of line
+//
+static Record record(const std::string & line)
+{
+	Record r;
+	const size_t t1 = line.find('\t');
+	const size_t t2 = line.find('\t', t1 + 1);
+	const size_t t3 = line.find('\t', t2 + 1);
+	const size_t t4 = line.find('\t', t3 + 1);
+	
+	r.chr = line.substr(0, t1);
+	r.pos = std::stoul(line.substr(t1 + 1, t2 - t1 - 1));
+	r.len = t4 - t3 - 1;
+	
+	return r;
+}
+
+
+//
+// write BGZF block of raw bytes
+//
+static void block(std::string & out, const char * raw, const size_t n)
+{
+	std::vector<unsigned char> buf(compressBound(n) + 64);
+	z_stream z;
+	
+	z.zalloc = Z_NULL;
+	z.zfree = Z_NULL;
+	z.opaque = Z_NULL;
+	deflateInit2(&z, 6, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+	z.next_in = (Bytef *)raw;
+	z.avail_in = (uInt)n;
+	z.next_out = &buf[0];
+	z.avail_out = (uInt)buf.size();
+	deflate(&z, Z_FINISH);
+	const size_t m = z.total_out;
+	deflateEnd(&z);
+	
+	const uint32_t crc = (uint32_t)crc32(crc32(0, Z_NULL, 0), (const Bytef *)raw, (uInt)n);
+	const uint16_t bsize = (uint16_t)(m + 25);
+	const unsigned char head[18] = { 31, 139, 8, 4, 0, 0, 0, 0, 0, 255, 6, 0, 'B', 'C', 2, 0, (unsigned char)(bsize & 0xff), (unsigned char)(bsize >> 8) };
+	
+	out.append((const char *)head, 18);
+	out.append((const char *)&buf[0], m);
+	
+	for (const uint32_t x : { crc, (uint32_t)n })
+		for (int k = 0; k < 4; ++k)
+			out.push_back((char)((x >> (8 * k)) & 0xff));
+}
+
+
+//
+// tabix bin of 0-based region [beg, end)
+//
+static uint32_t reg2bin(const size_t beg, size_t end)
+{
+	--end;
+	if (beg >> 14 == end >> 14) return ((1 << 15) - 1) / 7 + (uint32_t)(beg >> 14);
+	if (beg >> 17 == end >> 17) return ((1 << 12) - 1) / 7 + (uint32_t)(beg >> 17);
+	if (beg >> 20 == end >> 20) return ((1 <<  9) - 1) / 7 + (uint32_t)(beg >> 20);
+	if (beg >> 23 == end >> 23) return ((1 <<  6) - 1) / 7 + (uint32_t)(beg >> 23);
+	if (beg >> 26 == end >> 26) return ((1 <<  3) - 1) / 7 + (uint32_t)(beg >> 26);
+	return 0;
+}
+
+
+//
+// write text as BGZF file with blocks of given size, and its tabix index
+//
+static void write(const std::string & file, const std::string & text, const size_t size)
+{
+	typedef std::pair<uint64_t, uint64_t> Chunk;
+	
+	struct Reference
+	{
+		std::map<uint32_t, std::vector<Chunk>> bin;
+		std::map<size_t, uint64_t> linear;
+	};
+	
+	// compress blocks
+	std::string out;
+	std::vector<size_t> offset;
+	
+	for (size_t i = 0; i < text.size(); i += size)
+	{
+		offset.push_back(out.size());
+		block(out, text.data() + i, std::min(size, text.size() - i));
+	}
+	offset.push_back(out.size());
+	block(out, "", 0); // end-of-file marker
+	
+	std::ofstream(file, std::ios::binary).write(out.data(), out.size());
+	
+	// virtual offset of uncompressed position
+	auto voffset = [&](const size_t u) { return ((uint64_t)offset[u / size] << 16) | (u % size); };
+	
+	// index records
+	std::vector<std::string> order;
+	std::map<std::string, Reference> index;
+	
+	for (size_t u = 0, next; u < text.size(); u = next)
+	{
+		next = text.find('\n', u) + 1;
+		
+		if (text[u] == '#')
+			continue;
+		
+		const Record r = record(text.substr(u, next - u - 1));
+		const size_t beg = r.pos - 1, end = beg + r.len;
+		const uint64_t s = voffset(u), e = voffset(next);
+		
+		if (index.find(r.chr) == index.end())
+			order.push_back(r.chr);
+		
+		Reference & ref = index[r.chr];
+		std::vector<Chunk> & chunk = ref.bin[ reg2bin(beg, end) ];
+		
+		if (! chunk.empty() && chunk.back().second == s)
+			chunk.back().second = e;
+		else
+			chunk.push_back(Chunk(s, e));
+		
+		for (size_t w = beg >> 14; w <= (end - 1) >> 14; ++w)
+			if (ref.linear.find(w) == ref.linear.end())
+				ref.linear[w] = s;
+	}
+	
+	// write index
+	std::string nm;
+	
+	for (const std::string & chr : order)
+		nm += chr + '\0';
+	
+	gzFile gz = gzopen((file + ".tbi").c_str(), "wb");
+	
+	auto i32 = [&](const int32_t x) { gzwrite(gz, &x, 4); };
+	auto u64 = [&](const uint64_t x) { gzwrite(gz, &x, 8); };
+	
+	gzwrite(gz, "TBI\1", 4);
+	i32((int32_t)order.size());
+	for (const int32_t x : { 2, 1, 2, 0, (int)'#', 0 }) // VCF format, columns, meta char, skipped lines
+		i32(x);
+	i32((int32_t)nm.size());
+	gzwrite(gz, nm.data(), (unsigned)nm.size());
+	
+	for (const std::string & chr : order)
+	{
+		const Reference & ref = index[chr];
+		
+		i32((int32_t)ref.bin.size());
+		
+		for (const std::pair<const uint32_t, std::vector<Chunk>> & b : ref.bin)
+		{
+			i32((int32_t)b.first);
+			i32((int32_t)b.second.size());
+			
+			for (const Chunk & c : b.second)
+			{
+				u64(c.first);
+				u64(c.second);
+			}
+		}
+		
+		// fill windows without records from preceding window
+		const size_t n = ref.linear.rbegin()->first + 1;
+		uint64_t last = 0;
+		
+		i32((int32_t)n);
+		
+		for (size_t w = 0; w < n; ++w)
+		{
+			std::map<size_t, uint64_t>::const_iterator it = ref.linear.find(w);
+			
+			if (it != ref.linear.end())
+				last = it->second;
+			
+			u64(last);
+		}
+	}
+	
+	gzclose(gz);
+}
+
+
+//
+// keep lines of region
+//
+static std::vector<std::string> select(const std::vector<std::string> & lines, const std::string & chr, const size_t beg, const size_t end)
+{
+	std::vector<std::string> keep;
+	
+	for (const std::string & str : lines)
+	{
+		const Record r = record(str);
+		
+		if (r.chr == chr && r.pos >= beg && r.pos <= end)
+			keep.push_back(str);
+	}
+	
+	return keep;
+}
+
+
+//
+// read lines of file, restricted to blocks covering region if given
+//
+static std::vector<std::string> read(const std::string & file, const int threads, const std::string & chr = "", const size_t beg = 0, const size_t end = 0)
+{
+	std::vector<std::string> lines;
+	StreamLine line(file);
+	
+	line.threads(threads);
+	
+	if (! chr.empty())
+	{
+		StreamIndex tabix(file + ".tbi");
+		line.seek(tabix.query(chr, beg - 1, end));
+	}
+	
+	while (line.next())
+	{
+		const std::string str = line.str();
+		
+		if (! str.empty() && str[0] != '#')
+			lines.push_back(str);
+	}
+	
+	return (chr.empty()) ? lines: select(lines, chr, beg, end);
+}
+
+
+int main()
+{
+	std::mt19937 rng(1);
+	const std::string file = "region_query.vcf.gz";
+	const std::vector<std::string> chrs = { "1", "2", "10" };
+	
+	// sorted records with reference alleles of varying length
+	std::string text = "##fileformat=VCFv4.2\n#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\tFORMAT\tS1\tS2\n";
+	std::map<std::string, size_t> last;
+	
+	for (const std::string & chr : chrs)
+	{
+		size_t pos = 1 + rng() % 100;
+		
+		for (int i = 0; i < 3000; ++i)
+		{
+			const size_t len = 1 + ((rng() % 64 == 0) ? rng() % 40000: rng() % 4); // long alleles span bins
+			
+			text += chr + '\t' + std::to_string(pos) + "\t.\t" + std::string(len, 'A') + "\tG\t.\tPASS\t.\tGT\t0|1\t1|" + std::to_string(rng() % 2) + '\n';
+			last[chr] = pos;
+			
+			pos += (rng() % 16 == 0) ? rng() % 200000: rng() % 400; // gaps span empty windows
+		}
+	}
+	
+	size_t n_region = 0;
+	size_t n_fail = 0;
+	
+	for (const size_t size : { (size_t)65280, (size_t)4096, (size_t)700 })
+	{
+		write(file, text, size);
+		
+		std::vector< std::pair<std::string, std::pair<size_t, size_t>> > region;
+		
+		// whole & absent sequences, edges
+		for (const std::string & chr : chrs)
+		{
+			region.push_back(std::make_pair(chr, std::make_pair((size_t)1, (size_t)SIZE_MAX / 2)));
+			region.push_back(std::make_pair(chr, std::make_pair(last[chr], last[chr])));
+			region.push_back(std::make_pair(chr, std::make_pair(last[chr] + 1, last[chr] + 100000)));
+		}
+		region.push_back(std::make_pair(std::string("X"), std::make_pair((size_t)1, (size_t)1000000)));
+		
+		// random regions, narrow & wide
+		for (int i = 0; i < 100; ++i)
+		{
+			const std::string & chr = chrs[ rng() % chrs.size() ];
+			const size_t beg = 1 + rng() % (last[chr] + 1000);
+			const size_t len = (i % 2 == 0) ? rng() % 2000: rng() % 5000000;
+			
+			region.push_back(std::make_pair(chr, std::make_pair(beg, beg + len)));
+		}
+		
+		// full scan
+		const std::vector<std::string> lines = read(file, 1);
+		
+		for (const std::pair<std::string, std::pair<size_t, size_t>> & r : region)
+		{
+			const std::vector<std::string> expect = select(lines, r.first, r.second.first, r.second.second);
+			
+			for (const int threads : { 1, 4 })
+			{
+				++n_region;
+				
+				if (read(file, threads, r.first, r.second.first, r.second.second) != expect)
+				{
+					std::cerr << "Lines differ in region " << r.first << ':' << r.second.first << '-' << r.second.second << " with block size " << size << " on " << threads << " threads" << std::endl;
+					++n_fail;
+				}
+			}
+		}
+	}
+	
+	std::remove(file.c_str());
+	std::remove((file + ".tbi").c_str());
+	
+	std::cout << n_region << " regions checked, " << n_fail << " mismatches" << std::endl;
+	
+	return (n_fail == 0) ? EXIT_SUCCESS: EXIT_FAILURE;
+}
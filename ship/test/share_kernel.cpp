@@ -0,0 +1,172 @@
+//
+//  share_kernel.cpp
+//  ship
+//
+//  Timing of both kernels counting all carrier pairs of a block of roots, as in
+//  Shared::share_all, to calibrate SHARED_BITSET_COST: the cost of adding one
+//  carrier pair relative to intersecting one word of bitsets. Both kernels must
+//  give the same counts.
+//
+//  Build & run from ship/, with and without hardware popcount:
+//  c++ -std=c++14 -O2 -mpopcnt -pthread -I. test/share_kernel.cpp shared.cpp source.cpp stream.cpp marker.cpp allele.cpp census.cpp genmap.cpp sample.cpp timer.cpp -lz -o share_kernel && ./share_kernel
+//  c++ -std=c++14 -O2 -mno-popcnt -pthread -I. test/share_kernel.cpp shared.cpp source.cpp stream.cpp marker.cpp allele.cpp census.cpp genmap.cpp sample.cpp timer.cpp -lz -o share_kernel && ./share_kernel
+//
+
+#include <iostream>
+#include <chrono>
+#include <random>
+
+#include "shared.h"
+
+
+typedef std::vector< std::vector<size_t> > Roots; // carriers of each root, ascending
+
+
+//
+// enumerate carrier pairs of each root, return number of pairs
+//
+static size_t enumerate(const Roots & root, SharedMatrix & matrix)
+{
+	size_t n_pair = 0;
+	
+	for (const std::vector<size_t> & sample_id : root)
+	{
+		for (size_t k0 = 0, nsub = sample_id.size(); k0 < nsub; ++k0)
+		{
+			for (size_t k1 = k0 + 1; k1 < nsub; ++k1)
+			{
+				matrix.add(sample_id[k0], sample_id[k1]);
+			}
+		}
+		
+		n_pair += sample_id.size() * (sample_id.size() - 1) / 2;
+	}
+	
+	return n_pair;
+}
+
+
+//
+// intersect bitsets of roots carried by each pair of active samples, return number of words
+//
+static size_t intersect(const Roots & root, const size_t n, SharedMatrix & matrix)
+{
+	const size_t n_word = (root.size() + 63) / 64;
+	std::vector<size_t> index(n, 0); // position of sample in active + 1
+	std::vector<size_t> active;
+	
+	for (const std::vector<size_t> & sample_id : root)
+	{
+		for (const size_t x : sample_id)
+		{
+			if (index[x] == 0)
+			{
+				active.push_back(x);
+				index[x] = 1;
+			}
+		}
+	}
+	
+	std::sort(active.begin(), active.end());
+	
+	const size_t n_active = active.size();
+	
+	for (size_t a = 0; a < n_active; ++a)
+		index[ active[a] ] = a + 1;
+	
+	std::vector<uint64_t> bits(n_active * n_word, 0);
+	
+	for (size_t i = 0; i < root.size(); ++i)
+		for (const size_t x : root[i])
+			bits[ (index[x] - 1) * n_word + i / 64 ] |= uint64_t(1) << (i % 64);
+	
+	for (size_t a = 0; a < n_active; ++a)
+	{
+		const uint64_t * x = &bits[a * n_word];
+		
+		for (size_t b = a + 1; b < n_active; ++b)
+		{
+			const uint64_t * y = &bits[b * n_word];
+			uint32_t c = 0;
+			
+			for (size_t w = 0; w < n_word; ++w)
+			{
+				c += __builtin_popcountll(x[w] & y[w]);
+			}
+			
+			if (c != 0)
+				matrix.add(active[a], active[b], c);
+		}
+	}
+	
+	return n_active * (n_active - 1) / 2 * n_word;
+}
+
+
+//
+// return seconds elapsed since start
+//
+static double since(const std::chrono::steady_clock::time_point & start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+int main()
+{
+	std::mt19937 rng(1);
+	size_t n_fail = 0;
+
+#if defined(__POPCNT__)
+	std::cout << "hardware popcount" << std::endl;
+#else
+	std::cout << "software popcount" << std::endl;
+#endif
+	
+	// samples, roots per block (SHARED_BITSET_BLOCK), max carriers per root
+	for (const std::vector<size_t> & c : std::vector< std::vector<size_t> >{ { 2000, 4096, 20 }, { 2000, 4096, 200 }, { 10000, 4096, 400 } })
+	{
+		const size_t n = c[0];
+		Roots root(c[1]);
+		
+		for (std::vector<size_t> & sample_id : root)
+		{
+			const size_t nsub = 2 + rng() % (c[2] - 1);
+			
+			while (sample_id.size() < nsub)
+				sample_id.push_back(rng() % n);
+			
+			std::sort(sample_id.begin(), sample_id.end());
+			sample_id.erase(std::unique(sample_id.begin(), sample_id.end()), sample_id.end());
+		}
+		
+		SharedMatrix m0(n), m1(n);
+		m0.dense();
+		m1.dense();
+		
+		// touch pages of both matrices, counts are compared after doubling
+		enumerate(root, m0);
+		intersect(root, n, m1);
+		
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		const size_t n_pair = enumerate(root, m0);
+		const double t_pair = since(start);
+		
+		start = std::chrono::steady_clock::now();
+		const size_t n_word = intersect(root, n, m1);
+		const double t_word = since(start);
+		
+		for (size_t x = 0; x < n; ++x)
+			for (size_t y = x + 1; y < n; ++y)
+				n_fail += (m0.get(x, y) != m1.get(x, y));
+		
+		std::cout << n << " samples, " << root.size() << " roots of up to " << c[2] << " carriers: "
+			<< t_pair / n_pair * 1e9 << " ns per pair, "
+			<< t_word / n_word * 1e9 << " ns per word, cost "
+			<< (t_pair / n_pair) / (t_word / n_word) << std::endl;
+	}
+	
+	std::cout << n_fail << " differences between kernels" << std::endl;
+	
+	return (n_fail == 0) ? EXIT_SUCCESS: EXIT_FAILURE;
+}
@@ -0,0 +1,215 @@
+//
+//  shared_matrix.cpp
+//  ship
+//
+//  Check that dense, sparse & binary output of the sharing matrix agree with
+//  the counts added, for shards in triangle & hash mode.
+//
+//  Build & run from ship/:
+//  c++ -std=c++14 -O2 -pthread -I. test/shared_matrix.cpp shared.cpp source.cpp stream.cpp marker.cpp allele.cpp census.cpp genmap.cpp sample.cpp timer.cpp -lz -o shared_matrix && ./shared_matrix
+//
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <map>
+
+#include "shared.h"
+
+
+typedef std::map<std::pair<size_t, size_t>, uint32_t> Count; // expected counts, x < y
+
+
+//
+// write matrix in format, return file contents
+//
+static std::string output(const SharedMatrix & matrix, const Source & source, const char format)
+{
+	const std::string file = "shared_matrix.out";
+	StreamOut stream;
+	
+	stream.open(file);
+	
+	switch (format)
+	{
+		case 'd': matrix.print_dense(stream, source); break;
+		case 's': matrix.print_sparse(stream, source); break;
+		default:  matrix.print_binary(stream); break;
+	}
+	
+	stream.close();
+	
+	std::ifstream in(file, std::ios::binary);
+	std::string str((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	
+	std::remove(file.c_str());
+	
+	return str;
+}
+
+
+//
+// expected count of pair, symmetric
+//
+static uint32_t expect(const Count & count, const size_t x, const size_t y)
+{
+	Count::const_iterator it = count.find(std::make_pair(std::min(x, y), std::max(x, y)));
+	
+	return (it == count.end()) ? 0: it->second;
+}
+
+
+//
+// compare outputs with expected counts, return number of differences
+//
+static size_t check(const SharedMatrix & matrix, const Source & source, const Count & count)
+{
+	const size_t n = matrix.size();
+	size_t n_diff = 0;
+	
+	// dense, header & one row per sample
+	{
+		std::istringstream in(output(matrix, source, 'd'));
+		std::string token;
+		
+		in >> token;
+		for (size_t y = 0; y < n; ++y)
+			in >> token;
+		
+		for (size_t x = 0; x < n; ++x)
+		{
+			in >> token;
+			n_diff += (token != source.sample(x).info.key);
+			
+			for (size_t y = 0; y < n; ++y)
+			{
+				uint32_t c = 0;
+				in >> c;
+				n_diff += (c != expect(count, x, y));
+			}
+		}
+		
+		n_diff += ! (in >> token).fail(); // no trailing values
+	}
+	
+	// sparse, one line per pair with non-zero count
+	{
+		std::istringstream in(output(matrix, source, 's'));
+		std::string line, id0, id1;
+		uint32_t c;
+		size_t n_line = 0;
+		
+		std::getline(in, line);
+		
+		while (in >> id0 >> id1 >> c)
+		{
+			const size_t x = std::stoul(id0.substr(1));
+			const size_t y = std::stoul(id1.substr(1));
+			
+			n_diff += (x >= y || c == 0 || c != expect(count, x, y));
+			++n_line;
+		}
+		
+		n_diff += (n_line != count.size());
+	}
+	
+	// binary, header & full matrix of little-endian counts
+	{
+		const std::string str = output(matrix, source, 'b');
+		
+		if (str.size() != 24 + n * n * 4 || str.compare(0, 8, std::string("SHIPSHR\0", 8)) != 0)
+		{
+			return n_diff + 1;
+		}
+		
+		for (size_t x = 0; x < n; ++x)
+		{
+			for (size_t y = 0; y < n; ++y)
+			{
+				const unsigned char * p = (const unsigned char *)str.data() + 24 + (x * n + y) * 4;
+				const uint32_t c = p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+				
+				n_diff += (c != expect(count, x, y));
+			}
+		}
+	}
+	
+	// direct lookup
+	for (size_t x = 0; x < n; ++x)
+		for (size_t y = 0; y < n; ++y)
+			n_diff += (matrix.get(x, y) != expect(count, x, y));
+	
+	return n_diff;
+}
+
+
+int main()
+{
+	std::mt19937 rng(1);
+	size_t n_case = 0;
+	size_t n_fail = 0;
+	
+	for (const size_t n : { 1, 2, 5, 64, 301 })
+	{
+		Source source('m', true);
+		
+		for (size_t i = 0; i < n; ++i)
+		{
+			Sample sample;
+			sample.info.key = "S" + std::to_string(i);
+			source.append(std::move(sample));
+		}
+		
+		for (const size_t shards : { 1, 3, 8 })
+		{
+			// density falls with rows, first shards turn into triangles
+			for (const double scale : { 0.0, 0.05, 1.0 })
+			{
+				SharedMatrix matrix(n, shards);
+				Count count;
+				
+				for (size_t x = 0; x < n; ++x)
+				{
+					const double p = scale * ((x < n / 3) ? 0.3: (x < 2 * n / 3) ? 0.03: 0.003);
+					
+					for (size_t y = x + 1; y < n; ++y)
+					{
+						if (std::generate_canonical<double, 32>(rng) >= p)
+							continue;
+						
+						// pairs added in either order & repeatedly
+						const uint32_t c = 1 + rng() % 3;
+						
+						if (rng() % 2 == 0)
+							matrix.add(x, y, c);
+						else
+							matrix.add(y, x, c);
+						
+						count[ std::make_pair(x, y) ] += c;
+					}
+				}
+				
+				++n_case;
+				
+				const size_t n_diff = check(matrix, source, count);
+				
+				if (n_diff != 0)
+				{
+					std::cerr << n_diff << " differences with " << n << " samples, " << shards << " shards, " << matrix.dense_shards() << " dense" << std::endl;
+					++n_fail;
+				}
+				
+				if (matrix.nonzero() != count.size())
+				{
+					std::cerr << "Unexpected number of non-zero pairs with " << n << " samples, " << shards << " shards" << std::endl;
+					++n_fail;
+				}
+			}
+		}
+	}
+	
+	std::cout << n_case << " matrices checked, " << n_fail << " mismatches" << std::endl;
+	
+	return (n_fail == 0) ? EXIT_SUCCESS: EXIT_FAILURE;
+}
@@ -0,0 +1,176 @@
+//
+//  snapshot.cpp
+//  ship
+//
+//  Check that a source saved to a binary snapshot and loaded again equals the
+//  source parsed from the input file.
+//
+//  Build & run from ship/:
+//  c++ -std=c++14 -O2 -pthread -I. test/snapshot.cpp input.cpp source.cpp stream.cpp marker.cpp allele.cpp census.cpp genmap.cpp sample.cpp timer.cpp -lz -o snapshot && ./snapshot
+//
+
+#include <iostream>
+#include <fstream>
+#include <random>
+
+#include "input.h"
+
+
+//
+// random genotype field, with missing and multi-allelic haplotypes
+//
+static std::string field(std::mt19937 & rng, const int n_allele, const bool missing)
+{
+	std::string h[2];
+	
+	for (int k = 0; k < 2; ++k)
+	{
+		if (missing && rng() % 20 == 0)
+			h[k] = ".";
+		else if (rng() % 4 == 0)
+			h[k] = std::to_string(rng() % n_allele);
+		else
+			h[k] = "0";
+	}
+	
+	return h[0] + '|' + h[1];
+}
+
+
+//
+// compare sources, return number of differences
+//
+static size_t compare(const Source & a, const Source & b)
+{
+	size_t n_diff = 0;
+	
+	if (a.sample_size() != b.sample_size() || a.marker_size() != b.marker_size())
+	{
+		std::cerr << "Sizes differ" << std::endl;
+		return 1;
+	}
+	
+	for (size_t i = 0; i < a.sample_size(); ++i)
+	{
+		const SampleInfo & x = a.sample(i).info;
+		const SampleInfo & y = b.sample(i).info;
+		
+		if (x.key != y.key || x.pop != y.pop || x.grp != y.grp)
+		{
+			std::cerr << "Sample " << i << " differs" << std::endl;
+			++n_diff;
+		}
+	}
+	
+	for (size_t i = 0; i < a.marker_size(); ++i)
+	{
+		const SourceMarker x = a.marker(i);
+		const SourceMarker y = b.marker(i);
+		bool same = (x.info().str() == y.info().str() &&
+					 x.gmap().str() == y.gmap().str() &&
+					 x.stat().str() == y.stat().str() &&
+					 x.data().size() == y.data().size() &&
+					 x.data().is_binary() == y.data().is_binary());
+		
+		for (size_t k = 0; same && k < x.data().size(); ++k)
+			same = (x.data()[k] == y.data()[k]);
+		
+		// column table of hot fields
+		same = same &&
+			a.table().pos(i) == b.table().pos(i) &&
+			a.table().chr(i) == b.table().chr(i) &&
+			a.table().dist(i) == b.table().dist(i) &&
+			a.table().key(i) == b.table().key(i) &&
+			a.table().is_binary(i) == b.table().is_binary(i) &&
+			a.table().allele_size(i) == b.table().allele_size(i);
+		
+		for (int h = 0; same && h < a.table().allele_size(i); ++h)
+			same = (a.table().allele_count(i, h) == b.table().allele_count(i, h));
+		
+		if (! same)
+		{
+			std::cerr << "Marker " << i << " differs: " << x.info().str() << std::endl;
+			++n_diff;
+		}
+	}
+	
+	return n_diff;
+}
+
+
+int main()
+{
+	std::mt19937 rng(1);
+	const std::string file = "snapshot.vcf";
+	const std::string snap = "snapshot.bin";
+	const uint64_t key = 0x5eed;
+	size_t n_fail = 0;
+	
+	// input with multi-allelic markers, missing data & duplicate positions
+	{
+		std::ofstream out(file);
+		const size_t n = 53;
+		size_t pos = 100;
+		
+		out << "##fileformat=VCFv4.2\n#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\tFORMAT";
+		for (size_t i = 0; i < n; ++i)
+			out << "\tS" << i;
+		out << '\n';
+		
+		for (int m = 0; m < 700; ++m)
+		{
+			const int n_allele = (m % 7 == 0) ? 3: 2;
+			const bool missing = (m % 5 == 0);
+			
+			out << "3\t" << pos << "\trs" << m << "\tA\t" << ((n_allele == 3) ? "G,T": "G") << "\t.\tPASS\t.\tGT";
+			for (size_t i = 0; i < n; ++i)
+				out << '\t' << field(rng, n_allele, missing);
+			out << '\n';
+			
+			pos += (rng() % 4 == 0) ? 0: 1 + rng() % 500;
+		}
+	}
+	
+	for (const int threads : { 1, 3 })
+	{
+		Source source('m', true);
+		
+		Input_VCF input(file);
+		input.run(source, threads);
+		source.finish(threads);
+		source.save(snap, key);
+		
+		if (source.marker_size() != 700)
+		{
+			std::cerr << "Parsed " << source.marker_size() << " of 700 markers" << std::endl;
+			++n_fail;
+		}
+		
+		// snapshot of other inputs is a miss
+		Source miss('m', true);
+		
+		if (miss.load(snap, key + 1))
+		{
+			std::cerr << "Snapshot loaded with different key" << std::endl;
+			++n_fail;
+		}
+		
+		Source loaded('m', true);
+		
+		if (! loaded.load(snap, key))
+		{
+			std::cerr << "Cannot load snapshot" << std::endl;
+			++n_fail;
+			continue;
+		}
+		
+		n_fail += compare(source, loaded);
+	}
+	
+	std::remove(file.c_str());
+	std::remove(snap.c_str());
+	
+	std::cout << n_fail << " failed checks" << std::endl;
+	
+	return (n_fail == 0) ? EXIT_SUCCESS: EXIT_FAILURE;
+}
@@ -0,0 +1,163 @@
+//
+//  source_sort.cpp
+//  ship
+//
+//  Check that finishing a source sorts markers appended out of order by
+//  position, ties by input line, on any number of threads, and that each
+//  marker keeps its own data after the in-place permutation.
+//
+//  Build & run from ship/:
+//  c++ -std=c++14 -O2 -pthread -I. test/source_sort.cpp source.cpp stream.cpp marker.cpp allele.cpp census.cpp genmap.cpp sample.cpp timer.cpp -lz -o source_sort && ./source_sort
+//
+
+#include <iostream>
+#include <random>
+
+#include "source.h"
+
+
+//
+// genotype of sample at marker of input line
+//
+static Genotype genotype(const size_t line, const size_t i)
+{
+	const size_t h = (line * 31 + i * 17) % 11;
+	
+	return Genotype((h == 0) ? 1: 0, (h == 1 || h == 2) ? 1: 0);
+}
+
+
+//
+// marker of input line, ID & data derived from line
+//
+static Marker marker(const size_t line, const size_t pos, const size_t n)
+{
+	Marker m(n);
+	
+	m.info.chr = 1;
+	m.info.pos = pos;
+	m.info.key = "m" + std::to_string(line);
+	m.info.allele.append(Allele("A"));
+	m.info.allele.append(Allele("G"));
+	
+	for (size_t i = 0; i < n; ++i)
+		m.data.append(genotype(line, i));
+	
+	m.stat.evaluate(m.info, m.data);
+	
+	return m;
+}
+
+
+//
+// append markers in given order & finish, return number of misplaced markers
+//
+static size_t check(const std::vector<size_t> & pos, const std::vector<size_t> & append, const size_t n, const int threads)
+{
+	Source source('m', true);
+	
+	for (size_t i = 0; i < n; ++i)
+	{
+		Sample sample;
+		sample.info.key = "S" + std::to_string(i);
+		source.append(std::move(sample));
+	}
+	
+	for (const size_t line : append)
+	{
+		Marker m = marker(line, pos[line], n);
+		source.pack(m);
+		source.append(std::move(m), line);
+	}
+	
+	source.finish(threads);
+	
+	// expected order of lines
+	std::vector<size_t> expect(pos.size());
+	
+	for (size_t line = 0; line < pos.size(); ++line)
+		expect[line] = line;
+	
+	std::stable_sort(expect.begin(), expect.end(), [&pos](const size_t a, const size_t b) { return pos[a] < pos[b]; });
+	
+	size_t n_diff = 0;
+	
+	for (size_t i = 0; i < source.marker_size(); ++i)
+	{
+		const size_t line = expect[i];
+		const SourceMarker m = source.marker(i);
+		bool same = (m.info().key == "m" + std::to_string(line) &&
+					 m.info().pos == pos[line] &&
+					 source.table().pos(i) == pos[line] &&
+					 source.table().key(i) == m.info().key &&
+					 m.data().size() == n);
+		
+		for (size_t k = 0; same && k < n; ++k)
+			same = (m.data()[k] == genotype(line, k));
+		
+		same = same && (m.stat().str() == marker(line, pos[line], n).stat.str());
+		
+		n_diff += ! same;
+	}
+	
+	return n_diff + (source.marker_size() != pos.size());
+}
+
+
+int main()
+{
+	std::mt19937 rng(1);
+	size_t n_case = 0;
+	size_t n_fail = 0;
+	
+	for (const size_t m : { 1, 2, 3, 7, 64, 1000, 20011 })
+	{
+		// positions with ties, input lines in file order
+		std::vector<size_t> pos(m);
+		
+		for (size_t line = 0; line < m; ++line)
+			pos[line] = 1 + rng() % (m / 2 + 1);
+		
+		std::vector<size_t> sorted(m);
+		
+		for (size_t line = 0; line < m; ++line)
+			sorted[line] = line;
+		
+		std::sort(pos.begin(), pos.end());
+		
+		// appended in file order (sorted input), shuffled or in batches out of order (parsing threads)
+		std::vector<size_t> shuffled = sorted;
+		std::shuffle(shuffled.begin(), shuffled.end(), rng);
+		
+		std::vector<size_t> batches = sorted;
+		for (size_t b = 0; b < m; b += 97)
+			std::reverse(batches.begin() + b, batches.begin() + std::min(m, b + 97));
+		std::reverse(batches.begin(), batches.end());
+		
+		std::vector<size_t> unsorted_pos = pos;
+		std::shuffle(unsorted_pos.begin(), unsorted_pos.end(), rng);
+		
+		for (const int threads : { 1, 2, 3, 8 })
+		{
+			for (const std::vector<size_t> * append : { &sorted, &shuffled, &batches })
+			{
+				for (const std::vector<size_t> * p : { &pos, &unsorted_pos })
+				{
+					++n_case;
+					
+					const size_t n_diff = check(*p, *append, 5 + m % 7, threads);
+					
+					if (n_diff != 0)
+					{
+						std::cerr << n_diff << " misplaced of " << m << " markers on " << threads << " threads" << std::endl;
+						++n_fail;
+					}
+				}
+			}
+		}
+	}
+	
+	std::cout << n_case << " sorts checked, " << n_fail << " failed" << std::endl;
+	
+	return (n_fail == 0) ? EXIT_SUCCESS: EXIT_FAILURE;
+}
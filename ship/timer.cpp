@@ -204,7 +204,7 @@ void ProgressMsg::update(const size_t _i)
 {
 	this->i += _i;
 	
-	if (this->i % this->rate != 0)
+	if (this->i / this->rate == (this->i - _i) / this->rate) // check only when passing multiple of rate
 		return;
 	
 	const double elapsed = std::chrono::duration_cast<std::chrono::duration<double> >(std::chrono::steady_clock::now() - this->time).count(); 
@@ -261,3 +261,102 @@ const double ProgressMsg::interval = 1.0; // print interval in seconds
 const int    ProgressMsg::size = 4096;    // max size, not exact size
 
 
+//
+// Progress counter - lock-free updates from many threads, rendered by one reporter thread
+//
+ProgressCounter::ProgressCounter(ProgressBar & bar)
+: render([&bar] (const size_t n) { bar.update(n); })
+, reported(0)
+, done(false)
+{
+	for (int k = 0; k < PROGRESS_SHARDS; ++k)
+		this->shard[k].n.store(0, std::memory_order_relaxed);
+	
+	this->reporter = std::thread(&ProgressCounter::report, this);
+}
+
+ProgressCounter::ProgressCounter(ProgressMsg & msg)
+: render([&msg] (const size_t n) { msg.update(n); })
+, reported(0)
+, done(false)
+{
+	for (int k = 0; k < PROGRESS_SHARDS; ++k)
+		this->shard[k].n.store(0, std::memory_order_relaxed);
+	
+	this->reporter = std::thread(&ProgressCounter::report, this);
+}
+
+ProgressCounter::~ProgressCounter()
+{
+	this->finish();
+}
+
+int ProgressCounter::index()
+{
+	static std::atomic<int> next(0);
+	thread_local int k = next.fetch_add(1, std::memory_order_relaxed) % PROGRESS_SHARDS;
+	return k;
+}
+
+void ProgressCounter::update(const size_t _i)
+{
+	this->shard[ ProgressCounter::index() ].n.fetch_add(_i, std::memory_order_relaxed);
+}
+
+size_t ProgressCounter::sum() const
+{
+	size_t n = 0;
+	
+	for (int k = 0; k < PROGRESS_SHARDS; ++k)
+		n += this->shard[k].n.load(std::memory_order_relaxed);
+	
+	return n;
+}
+
+size_t ProgressCounter::count() const
+{
+	return this->sum();
+}
+
+void ProgressCounter::report()
+{
+	const std::chrono::duration<double> wait(ProgressCounter::interval);
+	std::unique_lock<std::mutex> lock(this->ex_done);
+	
+	while (! this->cv_done.wait_for(lock, wait, [this] { return this->done; }))
+	{
+		const size_t n = this->sum();
+		
+		if (n > this->reported)
+		{
+			this->render(n - this->reported);
+			this->reported = n;
+		}
+	}
+}
+
+void ProgressCounter::finish()
+{
+	{
+		std::lock_guard<std::mutex> lock(this->ex_done);
+		
+		if (this->done)
+			return;
+		
+		this->done = true;
+	}
+	
+	this->cv_done.notify_one();
+	this->reporter.join();
+	
+	// render remaining count
+	const size_t n = this->sum();
+	
+	if (n > this->reported)
+	{
+		this->render(n - this->reported);
+		this->reported = n;
+	}
+}
+
+const double ProgressCounter::interval = 0.1; // render interval in seconds
@@ -18,6 +18,11 @@
 #include <sstream>
 #include <iomanip>
 #include <chrono>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
 
 
 //******************************************************************************
@@ -144,5 +149,64 @@ public:
 };
 
 
+//
+// Progress counter - lock-free updates from many threads, rendered by one reporter thread
+//
+
+#define PROGRESS_SHARDS 16 // number of counters
+
+class ProgressCounter
+{
+private:
+	
+	// counter on its own cache line
+	struct alignas(64) Shard
+	{
+		std::atomic<size_t> n;
+	};
+	
+	static const double interval; // render interval
+	
+	Shard shard[PROGRESS_SHARDS]; // counters, threads are spread across
+	
+	const std::function<void(const size_t)> render; // forward count to progress bar/message
+	size_t reported; // count forwarded so far
+	
+	bool done; // flag that updates are finished
+	std::mutex ex_done;
+	std::condition_variable cv_done;
+	std::thread reporter; // renders progress periodically
+	
+	// sum of all counters
+	size_t sum() const;
+	
+	// render periodically until finished
+	void report();
+	
+	// shard of calling thread
+	static int index();
+	
+public:
+	
+	// update progress, safe to call from any thread
+	void update(const size_t = 1);
+	
+	// return current count
+	size_t count() const;
+	
+	// stop reporter and render remaining count
+	void finish();
+	
+	// construct/destruct
+	ProgressCounter(ProgressBar &);
+	ProgressCounter(ProgressMsg &);
+	~ProgressCounter();
+	
+	// do not copy
+	ProgressCounter(const ProgressCounter &) = delete;
+	ProgressCounter & operator = (const ProgressCounter &) = delete;
+};
+
+
 
 #endif /* defined(__ship__timer__) */
@@ -103,6 +103,9 @@ public:
 	{
 		this->value = (i < 1 || i > CHAR_MAX)? Chromosome::unknown: i; // reserve -1 for unknown
 	}
+	Chromosome(const Chromosome & other)
+	: value(other.value)
+	{}
 	
 	friend class std::hash<Chromosome>;
 };
@@ -217,6 +220,12 @@ private:
 	
 public:
 	
+	// return raw value, h0 << 4 | h1
+	unsigned char raw() const
+	{
+		return this->value;
+	}
+	
 	// cast genotype
 	operator Genotype () const
 	{
@@ -248,6 +257,9 @@ public:
 	Datatype(const Haplotype & _h0, const Haplotype & _h1)
 	: value(_h0.value << 4 | _h1.value)
 	{}
+	explicit Datatype(const unsigned char _value) // raw value, h0 << 4 | h1
+	: value(_value)
+	{}
 	
 	friend class std::hash<Datatype>;
 };